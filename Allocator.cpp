@@ -0,0 +1,336 @@
+#include <algorithm>
+
+#include "Allocator.h"
+
+using namespace Atlas;
+
+Allocator::Allocator()
+{
+  reset(0, 0);
+}
+
+void Allocator::reset(int width, int height)
+{
+  mWidth = width;
+  mHeight = height;
+  mNodes.clear();
+  mUnusedNodes.clear();
+  mAllocations.clear();
+  mUnusedIds.clear();
+  mNumAllocations = 0;
+  mUsedArea = 0;
+  mFreeRects.clear();
+
+  mNumHeights = 1;
+  while (mNumHeights < height + 1) {
+    mNumHeights *= 2;
+  }
+  mMaxWidth.assign(2 * mNumHeights, 0);
+
+  int root = createNode(-1, 0, 0, width, height);
+  if (width > 0 && height > 0) {
+    addFree(root);
+  }
+}
+
+int Allocator::createNode(int parent, int left, int top, int width,
+                          int height)
+{
+  int node;
+  if (mUnusedNodes.empty()) {
+    node = mNodes.size();
+    mNodes.push_back(Node());
+  } else {
+    node = mUnusedNodes.back();
+    mUnusedNodes.pop_back();
+  }
+
+  Node *n = &mNodes[node];
+  n->left = left;
+  n->top = top;
+  n->width = width;
+  n->height = height;
+  n->parent = parent;
+  n->child[0] = -1;
+  n->child[1] = -1;
+  n->id = -1;
+  return node;
+}
+
+void Allocator::addFree(int node)
+{
+  mFreeRects.insert(FreeRect(mNodes[node].height, mNodes[node].width, node));
+  updateMaxWidth(mNodes[node].height);
+}
+
+void Allocator::removeFree(int node)
+{
+  mFreeRects.erase(FreeRect(mNodes[node].height, mNodes[node].width, node));
+  updateMaxWidth(mNodes[node].height);
+}
+
+/*
+ * Set the segment tree leaf of a height to the widest free leaf of that
+ * height, the last one of the height in the set
+ */
+void Allocator::updateMaxWidth(int height)
+{
+  std::set<FreeRect>::iterator it =
+      mFreeRects.lower_bound(FreeRect(height + 1, 0, -1));
+
+  int width = 0;
+  if (it != mFreeRects.begin()) {
+    --it;
+    if (it->height == height) {
+      width = it->width;
+    }
+  }
+
+  int index = mNumHeights + height;
+  mMaxWidth[index] = width;
+  for (index /= 2; index >= 1; index /= 2) {
+    mMaxWidth[index] =
+        std::max(mMaxWidth[2 * index], mMaxWidth[2 * index + 1]);
+  }
+}
+
+/*
+ * Lowest height >= height that has a free leaf at least width wide, in the
+ * range [low, high] of segment tree node index. Only one path descends
+ * into ranges that do not fit, so this takes O(log heights).
+ */
+int Allocator::findHeight(int index, int low, int high, int height,
+                          int width)
+{
+  if (high < height || mMaxWidth[index] < width) {
+    return -1;
+  }
+  if (low == high) {
+    return low;
+  }
+
+  int mid = (low + high) / 2;
+  int found = findHeight(2 * index, low, mid, height, width);
+  if (found < 0) {
+    found = findHeight(2 * index + 1, mid + 1, high, height, width);
+  }
+  return found;
+}
+
+/*
+ * Take the best fitting free leaf and split it, as Node::place() does,
+ * until a node of exactly the size is left. The leftovers are free leaves.
+ */
+int Allocator::allocateNode(int width, int height)
+{
+  if (width <= 0 || height <= 0 || width > mWidth || height > mHeight) {
+    return -1;
+  }
+
+  int fitHeight = findHeight(1, 0, mNumHeights - 1, height, width);
+  if (fitHeight < 0) {
+    return -1;
+  }
+
+  int node = mFreeRects.lower_bound(FreeRect(fitHeight, width, -1))->node;
+  removeFree(node);
+
+  for (;;) {
+    /* Creating nodes may move them all, so only copies are used */
+    int left = mNodes[node].left;
+    int top = mNodes[node].top;
+    int w = mNodes[node].width;
+    int h = mNodes[node].height;
+    int dw = w - width;
+    int dh = h - height;
+    int child0, child1;
+
+    if (dw == 0 && dh == 0) {
+      return node;
+    }
+
+    if (dw > dh) {
+      child0 = createNode(node, left, top, width, h);
+      child1 = createNode(node, left + width, top, dw, h);
+    } else {
+      child0 = createNode(node, left, top, w, height);
+      child1 = createNode(node, left, top + height, w, dh);
+    }
+
+    mNodes[node].child[0] = child0;
+    mNodes[node].child[1] = child1;
+    addFree(child1);
+    node = child0;
+  }
+}
+
+int Allocator::allocate(int width, int height)
+{
+  int node = allocateNode(width, height);
+  if (node < 0) {
+    return -1;
+  }
+
+  int id;
+  if (mUnusedIds.empty()) {
+    id = mAllocations.size();
+    mAllocations.push_back(-1);
+  } else {
+    id = mUnusedIds.back();
+    mUnusedIds.pop_back();
+  }
+
+  mAllocations[id] = node;
+  mNodes[node].id = id;
+  mNumAllocations++;
+  mUsedArea += (long long)width * height;
+  return id;
+}
+
+void Allocator::free(int id)
+{
+  if (id < 0 || id >= (int)mAllocations.size() || mAllocations[id] < 0) {
+    return;
+  }
+
+  int node = mAllocations[id];
+  mNumAllocations--;
+  mUsedArea -= (long long)mNodes[node].width * mNodes[node].height;
+  mAllocations[id] = -1;
+  mUnusedIds.push_back(id);
+  mNodes[node].id = -1;
+
+  /* Merge with the sibling into the parent while the sibling is free */
+  int parent = mNodes[node].parent;
+  while (parent >= 0) {
+    Node *p = &mNodes[parent];
+    int sibling = p->child[0] == node ? p->child[1] : p->child[0];
+    if (mNodes[sibling].child[0] >= 0 || mNodes[sibling].id >= 0) {
+      break;
+    }
+
+    removeFree(sibling);
+    p->child[0] = -1;
+    p->child[1] = -1;
+    mUnusedNodes.push_back(node);
+    mUnusedNodes.push_back(sibling);
+
+    node = parent;
+    parent = p->parent;
+  }
+
+  addFree(node);
+}
+
+bool Allocator::getRect(int id, int *left, int *top, int *width, int *height)
+{
+  if (id < 0 || id >= (int)mAllocations.size() || mAllocations[id] < 0) {
+    return false;
+  }
+
+  Node *n = &mNodes[mAllocations[id]];
+  *left = n->left;
+  *top = n->top;
+  *width = n->width;
+  *height = n->height;
+  return true;
+}
+
+void Allocator::getUsage(Usage *usage)
+{
+  long long largestArea = 0;
+
+  usage->numAllocations = mNumAllocations;
+  usage->usedArea = mUsedArea;
+  usage->freeArea = 0;
+  usage->numFreeRects = mFreeRects.size();
+  usage->largestFreeWidth = 0;
+  usage->largestFreeHeight = 0;
+
+  std::set<FreeRect>::iterator it;
+  for (it = mFreeRects.begin(); it != mFreeRects.end(); ++it) {
+    long long area = (long long)it->width * it->height;
+    usage->freeArea += area;
+    if (area > largestArea) {
+      largestArea = area;
+      usage->largestFreeWidth = it->width;
+      usage->largestFreeHeight = it->height;
+    }
+  }
+
+  usage->fragmentation =
+      usage->freeArea ? 1.0 - (double)largestArea / usage->freeArea : 0.0;
+}
+
+/* Larger allocations first, the tallest before the widest */
+struct AllocationOrder {
+  std::vector<int> *widths, *heights;
+  bool operator()(int id1, int id2) const
+  {
+    if ((*heights)[id1] != (*heights)[id2]) {
+      return (*heights)[id1] > (*heights)[id2];
+    }
+    if ((*widths)[id1] != (*widths)[id2]) {
+      return (*widths)[id1] > (*widths)[id2];
+    }
+    return id1 < id2;
+  }
+};
+
+bool Allocator::planDefragment(Allocator *compacted,
+                               std::vector<Move> *moves)
+{
+  std::vector<int> ids;
+  std::vector<int> widths(mAllocations.size(), 0);
+  std::vector<int> heights(mAllocations.size(), 0);
+  for (size_t i = 0; i < mAllocations.size(); i++) {
+    if (mAllocations[i] >= 0) {
+      ids.push_back(i);
+      widths[i] = mNodes[mAllocations[i]].width;
+      heights[i] = mNodes[mAllocations[i]].height;
+    }
+  }
+
+  AllocationOrder order;
+  order.widths = &widths;
+  order.heights = &heights;
+  std::sort(ids.begin(), ids.end(), order);
+
+  /* Built aside so compacted is left as it was if the plan fails */
+  Allocator plan;
+  plan.reset(mWidth, mHeight);
+  plan.mAllocations.assign(mAllocations.size(), -1);
+  plan.mUnusedIds = mUnusedIds;
+  moves->clear();
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    int id = ids[i];
+    int node = plan.allocateNode(widths[id], heights[id]);
+    if (node < 0) {
+      moves->clear();
+      return false;
+    }
+
+    plan.mAllocations[id] = node;
+    plan.mNodes[node].id = id;
+    plan.mNumAllocations++;
+    plan.mUsedArea += (long long)widths[id] * heights[id];
+
+    Node *from = &mNodes[mAllocations[id]];
+    Node *to = &plan.mNodes[node];
+    if (from->left != to->left || from->top != to->top) {
+      Move move;
+      move.id = id;
+      move.fromLeft = from->left;
+      move.fromTop = from->top;
+      move.toLeft = to->left;
+      move.toTop = to->top;
+      move.width = widths[id];
+      move.height = heights[id];
+      moves->push_back(move);
+    }
+  }
+
+  *compacted = plan;
+  return true;
+}
@@ -0,0 +1,151 @@
+#ifndef _ALLOCATOR_H_
+#define _ALLOCATOR_H_
+
+#include <set>
+#include <vector>
+
+namespace Atlas {
+
+/*
+ * Runtime atlas allocator: areas are allocated and freed at any time, e.g.
+ * for a glyph or thumbnail cache that only uploads what changed.
+ *
+ * The free space is the free leaves of a guillotine tree, split the way
+ * the Atlas::Node tree of the packer is. Freeing an area merges it with
+ * its sibling for as long as that is free too, so freed space coalesces
+ * back into larger areas. Free leaves are indexed by height and width: an
+ * allocation takes the lowest one that fits, then the narrowest, in
+ * O(log n).
+ */
+class Allocator {
+
+public:
+  /*
+   * How the atlas is used. fragmentation is 0 when all free space is one
+   * rectangle and goes towards 1 as it is split into ever smaller ones.
+   */
+  struct Usage {
+    int numAllocations;
+    long long usedArea;
+    long long freeArea;
+    int numFreeRects;
+    int largestFreeWidth, largestFreeHeight; /* By area */
+    double fragmentation; /* 1 - largest free area / free area */
+  };
+
+  /* An allocation that moves when the atlas is defragmented */
+  struct Move {
+    int id;
+    int fromLeft, fromTop;
+    int toLeft, toTop;
+    int width, height;
+  };
+
+  Allocator();
+
+  /*
+   * Start over with an empty atlas of the given size. Allocation ids of
+   * before are no longer valid.
+   */
+  void reset(int width, int height);
+
+  /*
+   * allocate()
+   *
+   * Reserve an area of the given size. Returns its id (>= 0, ids of freed
+   * areas are reused), or -1 if there is no room for it.
+   */
+  int allocate(int width, int height);
+
+  /*
+   * free()
+   *
+   * Give back the area of an allocation.
+   */
+  void free(int id);
+
+  /*
+   * getRect()
+   *
+   * Get where an allocation is. Returns false if the id is not allocated.
+   */
+  bool getRect(int id, int *left, int *top, int *width, int *height);
+
+  void getUsage(Usage *usage);
+
+  /*
+   * planDefragment()
+   *
+   * Plan packing all allocations anew, larger ones first, to get the free
+   * space back in one piece. compacted is set to the allocator as it is
+   * after the plan, with the same ids, and moves to the allocations that
+   * move. To apply the plan, copy the moved areas from the old texture to
+   * a new one (the areas may overlap in place), then replace this
+   * allocator with compacted.
+   *
+   * Returns false, and plans nothing, if the allocations do not all fit
+   * when packed anew.
+   */
+  bool planDefragment(Allocator *compacted, std::vector<Move> *moves);
+
+  int getWidth() { return mWidth; }
+  int getHeight() { return mHeight; }
+  int getNumAllocations() { return mNumAllocations; }
+
+private:
+  struct Node {
+    int left, top, width, height;
+    int parent;
+    int child[2]; /* -1 when not split */
+    int id;       /* Allocation in the node, -1 if free */
+  };
+
+  /* Free leaves, by height, then width */
+  struct FreeRect {
+    FreeRect(int h, int w, int n)
+    {
+      height = h;
+      width = w;
+      node = n;
+    }
+    int height, width, node;
+    bool operator<(const FreeRect &other) const
+    {
+      if (height != other.height) {
+        return height < other.height;
+      }
+      if (width != other.width) {
+        return width < other.width;
+      }
+      return node < other.node;
+    }
+  };
+
+  int allocateNode(int width, int height);
+  int createNode(int parent, int left, int top, int width, int height);
+  void addFree(int node);
+  void removeFree(int node);
+  void updateMaxWidth(int height);
+  int findHeight(int index, int low, int high, int height, int width);
+
+  int mWidth, mHeight;
+  std::vector<Node> mNodes;
+  std::vector<int> mUnusedNodes;
+
+  /* Node of each allocation id, -1 for ids free to reuse */
+  std::vector<int> mAllocations;
+  std::vector<int> mUnusedIds;
+  int mNumAllocations;
+  long long mUsedArea;
+
+  std::set<FreeRect> mFreeRects;
+
+  /*
+   * Segment tree over the heights: widest free leaf of each height and
+   * the widest of each range, to find the lowest height that fits
+   */
+  std::vector<int> mMaxWidth;
+  int mNumHeights; /* Leaves of the segment tree, a power of two */
+};
+} // namespace Atlas
+#endif
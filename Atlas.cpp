@@ -1,26 +1,32 @@
+#include <algorithm>
 #include <stdio.h>
 
 #include "Atlas.h"
 
 using namespace Atlas;
 
-Node::Node(int left, int top, int right, int bottom)
+Node::Node(NodePool *pool, int id, int parent, int left, int top, int right,
+           int bottom)
 {
-  static int idcnt = 0;
-  mId = idcnt++;
+  mPool = pool;
+  mId = id;
+  mParent = parent;
   mLeft = left;
   mTop = top;
   mRight = right;
   mBottom = bottom;
 
-  mChild[0] = NULL;
-  mChild[1] = NULL;
+  mChild[0] = -1;
+  mChild[1] = -1;
   mLeaf = true;
   mInUse = false;
+  mRotated = false;
   mRect = NULL;
+  mMaxFreeWidth = right - left;
+  mMaxFreeHeight = bottom - top;
 }
 
-Node *Node::insert(NodeRect *rect)
+Node *Node::insert(NodeRect *rect, bool allowRotate)
 {
 
   Node *newNode = NULL;
@@ -28,56 +34,125 @@ Node *Node::insert(NodeRect *rect)
   int w = rect->getWidth();
   int h = rect->getHeight();
 
+  /*
+   * No free leaf below is both wide and tall enough, in either
+   * orientation. The first free leaf that fits is the same as without
+   * this check, so is the layout.
+   */
+  if (!(w <= mMaxFreeWidth && h <= mMaxFreeHeight) &&
+      !(allowRotate && h <= mMaxFreeWidth && w <= mMaxFreeHeight)) {
+    return NULL;
+  }
+
   if (!mLeaf) {
 
     /* This node is not a leaf - try inserting to its child nodes */
 
-    newNode = mChild[0]->insert(rect);
+    newNode = mPool->getNode(mChild[0])->insert(rect, allowRotate);
     if (!newNode) {
-      newNode = mChild[1]->insert(rect);
+      newNode = mPool->getNode(mChild[1])->insert(rect, allowRotate);
     }
 
   } else if (!mInUse) {
 
+    /*
+     * Prefer a perfect fit in either orientation, then the rect as it is
+     * and last the rect turned 90 degrees.
+     */
+
     if (w == getWidth() && h == getHeight()) {
-      /* The given size fits perfectly */
-      mRect = rect;
-      newNode = this;
-      mInUse = true;
-    } else {
-
-#if 0
-      /* Swap the width and height */
-      if (w > getWidth() || h > getHeight()) {
-	int tmp = w;
-	w = h;
-	h = tmp;
-      }
-#endif
-      if (w <= getWidth() && h <= getHeight()) {
-        /* Create new child nodes */
-
-        mLeaf = false;
-
-        int dw = getWidth() - w;
-        int dh = getHeight() - h;
-
-        if (dw > dh) {
-          mChild[0] = new Node(mLeft, mTop, mLeft + w, mBottom);
-          mChild[1] = new Node(mLeft + w, mTop, mRight, mBottom);
-        } else {
-          mChild[0] = new Node(mLeft, mTop, mRight, mTop + h);
-          mChild[1] = new Node(mLeft, mTop + h, mRight, mBottom);
-        }
-
-        newNode = mChild[0]->insert(rect);
-      }
+      newNode = place(rect, w, h, false);
+    } else if (allowRotate && h == getWidth() && w == getHeight()) {
+      newNode = place(rect, h, w, true);
+    } else if (w <= getWidth() && h <= getHeight()) {
+      newNode = place(rect, w, h, false);
+    } else if (allowRotate && h <= getWidth() && w <= getHeight()) {
+      newNode = place(rect, h, w, true);
+    }
+
+    if (newNode) {
+      newNode->updateFreeSpace();
     }
   }
 
   return newNode;
 }
 
+/*
+ * Update the free space of the ancestors of a leaf that was just taken,
+ * up to the first one it does not change
+ */
+void Node::updateFreeSpace()
+{
+  mMaxFreeWidth = 0;
+  mMaxFreeHeight = 0;
+
+  for (Node *node = this; node->mParent >= 0;) {
+    Node *parent = mPool->getNode(node->mParent);
+    Node *child0 = mPool->getNode(parent->mChild[0]);
+    Node *child1 = mPool->getNode(parent->mChild[1]);
+    int maxWidth = std::max(child0->mMaxFreeWidth, child1->mMaxFreeWidth);
+    int maxHeight = std::max(child0->mMaxFreeHeight, child1->mMaxFreeHeight);
+    if (maxWidth == parent->mMaxFreeWidth &&
+        maxHeight == parent->mMaxFreeHeight) {
+      break;
+    }
+    parent->mMaxFreeWidth = maxWidth;
+    parent->mMaxFreeHeight = maxHeight;
+    node = parent;
+  }
+}
+
+/*
+ * Put a rect, oriented to take w x h pixels, in this free leaf. The leaf
+ * is split until a node of exactly the right size is left.
+ */
+Node *Node::place(NodeRect *rect, int w, int h, bool rotated)
+{
+  if (w == getWidth() && h == getHeight()) {
+    /* The given size fits perfectly */
+    mRect = rect;
+    mInUse = true;
+    mRotated = rotated;
+    return this;
+  }
+
+  /* Create new child nodes */
+
+  int dw = getWidth() - w;
+  int dh = getHeight() - h;
+  int child0, child1;
+
+  /*
+   * Growing the pool may move every node, this one included, so
+   * only local copies are used once the first child exists.
+   */
+  NodePool *pool = mPool;
+  int id = mId;
+  int left = mLeft, top = mTop, right = mRight, bottom = mBottom;
+
+  /* With nothing left over on one side the cut can only go the other way */
+  bool verticalCut = dw > dh;
+  if (pool->getSplitRule() == SplitSmallerLeftover && dw > 0 && dh > 0) {
+    verticalCut = dw < dh;
+  }
+
+  if (verticalCut) {
+    child0 = pool->create(id, left, top, left + w, bottom);
+    child1 = pool->create(id, left + w, top, right, bottom);
+  } else {
+    child0 = pool->create(id, left, top, right, top + h);
+    child1 = pool->create(id, left, top + h, right, bottom);
+  }
+
+  Node *self = pool->getNode(id);
+  self->mLeaf = false;
+  self->mChild[0] = child0;
+  self->mChild[1] = child1;
+
+  return pool->getNode(child0)->place(rect, w, h, rotated);
+}
+
 void Node::poTraversal(int level, void (*callback)(int, Node *, void *),
                        void *param)
 {
@@ -88,10 +163,33 @@ void Node::poTraversal(int level, void (*callback)(int, Node *, void *),
     }
   }
 
-  if (mChild[0]) {
-    mChild[0]->poTraversal(level + 1, callback, param);
+  if (mChild[0] >= 0) {
+    mPool->getNode(mChild[0])->poTraversal(level + 1, callback, param);
   }
-  if (mChild[1]) {
-    mChild[1]->poTraversal(level + 1, callback, param);
+  if (mChild[1] >= 0) {
+    mPool->getNode(mChild[1])->poTraversal(level + 1, callback, param);
   }
 }
+
+Node *NodePool::reset(int width, int height, int numRects)
+{
+  mNodes.clear();
+
+  /*
+   * Each insert splits at most two nodes (four new children), reserving
+   * for that up front avoids growing the block in the middle of a tree.
+   */
+  if (numRects > 0) {
+    mNodes.reserve(1 + 4 * (size_t)numRects);
+  }
+
+  create(-1, 0, 0, width, height);
+  return getRoot();
+}
+
+int NodePool::create(int parent, int left, int top, int right, int bottom)
+{
+  int id = mNodes.size();
+  mNodes.push_back(Node(this, id, parent, left, top, right, bottom));
+  return id;
+}
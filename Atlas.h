@@ -1,6 +1,8 @@
 #ifndef _ATLAS_H_
 #define _ATLAS_H_
 
+#include <vector>
+
 namespace Atlas {
 
 class NodeRect {
@@ -28,10 +30,22 @@ private:
   int mWidth, mHeight;
 };
 
+class NodePool;
+
+/*
+ * Which way a free leaf is cut when a rect takes its corner. The cut runs
+ * along the rect's side such that one of the two leftovers stays whole.
+ */
+enum SplitRule {
+  SplitLargerLeftover,  /* Keep the larger leftover in one piece */
+  SplitSmallerLeftover, /* Keep the smaller leftover in one piece */
+};
+
 class Node {
 
 public:
-  Node(int left, int top, int right, int bottom);
+  Node(NodePool *pool, int id, int parent, int left, int top, int right,
+       int bottom);
   int getWidth() { return (mRight - mLeft); }
   int getHeight() { return (mBottom - mTop); }
   int getLeft() { return mLeft; }
@@ -41,18 +55,60 @@ public:
   int getId() { return mId; }
   bool isLeaf() { return mLeaf; }
   bool isInUse() { return mInUse; }
-  Node *insert(NodeRect *rect);
+  bool isRotated() { return mRotated; }
+  Node *insert(NodeRect *rect, bool allowRotate = false);
   void poTraversal(int level, void (*callback)(int, Node *, void *),
                    void *param);
   NodeRect *getRect() { return mRect; }
 
 private:
+  Node *place(NodeRect *rect, int w, int h, bool rotated);
+  void updateFreeSpace();
+
+  NodePool *mPool;
   int mId;
+  int mParent; /* Pool index of the parent, -1 for the root */
   int mLeft, mRight, mTop, mBottom;
   NodeRect *mRect;
   bool mLeaf;
-  Node *mChild[2];
+  int mChild[2]; /* Pool index of each child, -1 when not split */
   bool mInUse;
+  bool mRotated; /* Rect is stored turned 90 degrees */
+
+  /*
+   * Widest and tallest free leaf in the subtree, not necessarily the same
+   * one. insert() skips subtrees a rect can not fit in without walking
+   * them, so an insert no longer visits every node placed before it.
+   */
+  int mMaxFreeWidth, mMaxFreeHeight;
+};
+
+/*
+ * Contiguous store of the nodes of one atlas tree.
+ *
+ * Nodes refer to their children by pool index rather than by pointer so
+ * the store may grow without breaking the tree. reset() drops the whole
+ * tree at once and keeps the allocated block, which lets a search over
+ * many dimensions reuse the same memory for every attempt.
+ */
+class NodePool {
+
+public:
+  NodePool() { mSplitRule = SplitLargerLeftover; }
+
+  /* Clear the pool and create a new root node of the given size */
+  Node *reset(int width, int height, int numRects = 0);
+  Node *getRoot() { return mNodes.empty() ? NULL : &mNodes[0]; }
+  Node *getNode(int id) { return &mNodes[id]; }
+  int getNumNodes() { return mNodes.size(); }
+  int create(int parent, int left, int top, int right, int bottom);
+
+  void setSplitRule(SplitRule splitRule) { mSplitRule = splitRule; }
+  SplitRule getSplitRule() { return mSplitRule; }
+
+private:
+  std::vector<Node> mNodes;
+  SplitRule mSplitRule;
 };
 } // namespace Atlas
 #endif
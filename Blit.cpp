@@ -0,0 +1,90 @@
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Blit.h"
+#include "Pixels.h"
+
+/* Rotated copies go through square tiles that stay in the cache */
+#define TILE_SIZE 32
+
+void Blit::copy(const uint32_t *src, int srcPitch, uint32_t *dst,
+                int dstPitch, int width, int height)
+{
+  for (int y = 0; y < height; y++) {
+    memcpy(getRow(dst, dstPitch, y), getRow(src, srcPitch, y),
+           width * sizeof(uint32_t));
+  }
+}
+
+/*
+ * Rotate the tile of source rows [y0, y1) and columns [x0, x1). Source
+ * column x becomes destination row x, read bottom up.
+ */
+static void copyRotatedTile(const uint32_t *src, int srcPitch, uint32_t *dst,
+                            int dstPitch, int height, int x0, int x1, int y0,
+                            int y1)
+{
+  int x = x0;
+
+#ifdef __SSE2__
+  /*
+   * Transpose 4x4 blocks: four source rows, read bottom up, become four
+   * destination rows.
+   */
+  for (; x + 4 <= x1; x += 4) {
+    int y = y1;
+    for (; y - 4 >= y0; y -= 4) {
+      const uint32_t *row0 = getRow(src, srcPitch, y - 1) + x;
+      const uint32_t *row1 = getRow(src, srcPitch, y - 2) + x;
+      const uint32_t *row2 = getRow(src, srcPitch, y - 3) + x;
+      const uint32_t *row3 = getRow(src, srcPitch, y - 4) + x;
+      __m128i r0 = _mm_loadu_si128((const __m128i *)row0);
+      __m128i r1 = _mm_loadu_si128((const __m128i *)row1);
+      __m128i r2 = _mm_loadu_si128((const __m128i *)row2);
+      __m128i r3 = _mm_loadu_si128((const __m128i *)row3);
+      __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+      __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+      __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+      __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+      int dx = height - y;
+      _mm_storeu_si128((__m128i *)(getRow(dst, dstPitch, x) + dx),
+                       _mm_unpacklo_epi64(t0, t1));
+      _mm_storeu_si128((__m128i *)(getRow(dst, dstPitch, x + 1) + dx),
+                       _mm_unpackhi_epi64(t0, t1));
+      _mm_storeu_si128((__m128i *)(getRow(dst, dstPitch, x + 2) + dx),
+                       _mm_unpacklo_epi64(t2, t3));
+      _mm_storeu_si128((__m128i *)(getRow(dst, dstPitch, x + 3) + dx),
+                       _mm_unpackhi_epi64(t2, t3));
+    }
+    for (; y > y0; y--) {
+      const uint32_t *row = getRow(src, srcPitch, y - 1);
+      for (int i = 0; i < 4; i++) {
+        getRow(dst, dstPitch, x + i)[height - y] = row[x + i];
+      }
+    }
+  }
+#endif
+
+  for (; x < x1; x++) {
+    uint32_t *dstRow = getRow(dst, dstPitch, x);
+    for (int y = y0; y < y1; y++) {
+      dstRow[height - 1 - y] = getRow(src, srcPitch, y)[x];
+    }
+  }
+}
+
+void Blit::copyRotated(const uint32_t *src, int srcPitch, uint32_t *dst,
+                       int dstPitch, int width, int height)
+{
+  for (int y0 = 0; y0 < height; y0 += TILE_SIZE) {
+    int y1 = y0 + TILE_SIZE < height ? y0 + TILE_SIZE : height;
+    for (int x0 = 0; x0 < width; x0 += TILE_SIZE) {
+      int x1 = x0 + TILE_SIZE < width ? x0 + TILE_SIZE : width;
+      copyRotatedTile(src, srcPitch, dst, dstPitch, height, x0, x1, y0, y1);
+    }
+  }
+}
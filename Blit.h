@@ -0,0 +1,28 @@
+#ifndef _BLIT_H_
+#define _BLIT_H_
+
+#include <stdint.h>
+
+class Blit {
+
+public:
+  /*
+   * copy()
+   *
+   * Copy a width x height block of 32 bit pixels. Pitches are in bytes.
+   */
+  static void copy(const uint32_t *src, int srcPitch, uint32_t *dst,
+                   int dstPitch, int width, int height);
+
+  /*
+   * copyRotated()
+   *
+   * Copy a width x height block of 32 bit pixels turned 90 degrees
+   * clockwise: source pixel (x, y) goes to (height - 1 - y, x) of the
+   * height x width destination block. Pitches are in bytes.
+   */
+  static void copyRotated(const uint32_t *src, int srcPitch, uint32_t *dst,
+                          int dstPitch, int width, int height);
+};
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _BYTES_H_
+#define _BYTES_H_
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Append little endian values to a byte buffer, as in the file formats
+ * written
+ */
+static inline void putUint32(std::vector<uint8_t> *buf, uint32_t value)
+{
+  for (int i = 0; i < 4; i++) {
+    buf->push_back(value >> (8 * i));
+  }
+}
+
+static inline void putUint64(std::vector<uint8_t> *buf, uint64_t value)
+{
+  putUint32(buf, value);
+  putUint32(buf, value >> 32);
+}
+
+#endif
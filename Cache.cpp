@@ -0,0 +1,164 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "Cache.h"
+#include "Hash.h"
+
+#define CACHE_MAGIC "textureatlas-cache"
+#define CACHE_VERSION 1
+
+/*
+ * Read a line without its newline. Returns false at end of file.
+ */
+static bool readLine(FILE *fp, std::string *line)
+{
+  char buf[1024];
+  line->clear();
+
+  while (fgets(buf, sizeof(buf), fp)) {
+    line->append(buf);
+    if (!line->empty() && (*line)[line->size() - 1] == '\n') {
+      line->erase(line->size() - 1);
+      return true;
+    }
+  }
+  return !line->empty();
+}
+
+int Cache::load(const char *fileName, CacheManifest *manifest)
+{
+  FILE *fp = fopen(fileName, "rb");
+  if (!fp) {
+    return -1;
+  }
+
+  std::string line;
+  int version = 0;
+  int err = 0;
+
+  if (!readLine(fp, &line) ||
+      sscanf(line.c_str(), CACHE_MAGIC " %d", &version) != 1 ||
+      version != CACHE_VERSION) {
+    fclose(fp);
+    return -1;
+  }
+
+  while (!err && readLine(fp, &line)) {
+    const char *str = line.c_str();
+    int pos = 0;
+
+    if (strncmp(str, "options ", 8) == 0) {
+      manifest->signature = str + 8;
+    } else if (strncmp(str, "input ", 6) == 0) {
+      CacheManifest::Input input;
+      if (sscanf(str, "input %lld %lld %" SCNx64 " %n", &input.mtime,
+                 &input.size, &input.hash, &pos) < 3 ||
+          pos == 0) {
+        err = -1;
+      } else {
+        input.path = str + pos;
+        manifest->inputs.push_back(input);
+      }
+    } else if (strncmp(str, "page ", 5) == 0) {
+      CacheManifest::Page page;
+      if (sscanf(str, "page %d %d %n", &page.width, &page.height, &pos) < 2 ||
+          pos == 0) {
+        err = -1;
+      } else {
+        page.imageFileName = str + pos;
+        manifest->pages.push_back(page);
+      }
+    } else if (strncmp(str, "sprite ", 7) == 0) {
+      SpriteRecord sprite;
+      if (sscanf(str, "sprite %d %d %d %d %d %d %d %d %d %d %d %d %d %n",
+                 &sprite.input, &sprite.page, &sprite.left, &sprite.top,
+                 &sprite.width, &sprite.height, &sprite.rotated,
+                 &sprite.trimLeft, &sprite.trimTop, &sprite.sourceWidth,
+                 &sprite.sourceHeight, &sprite.slotWidth, &sprite.slotHeight,
+                 &pos) < 13 ||
+          pos == 0) {
+        err = -1;
+      } else {
+        sprite.name = str + pos;
+        manifest->sprites.push_back(sprite);
+      }
+    }
+  }
+
+  fclose(fp);
+  return err;
+}
+
+int Cache::save(const char *fileName, CacheManifest *manifest)
+{
+  FILE *fp = fopen(fileName, "wb");
+  if (!fp) {
+    printf("Failed to create cache file (%s): %s\n", fileName,
+           strerror(errno));
+    return -1;
+  }
+
+  fprintf(fp, CACHE_MAGIC " %d\n", CACHE_VERSION);
+  fprintf(fp, "options %s\n", manifest->signature.c_str());
+
+  for (size_t i = 0; i < manifest->inputs.size(); i++) {
+    CacheManifest::Input *input = &manifest->inputs[i];
+    fprintf(fp, "input %lld %lld %016" PRIx64 " %s\n", input->mtime,
+            input->size, input->hash, input->path.c_str());
+  }
+
+  for (size_t i = 0; i < manifest->pages.size(); i++) {
+    CacheManifest::Page *page = &manifest->pages[i];
+    fprintf(fp, "page %d %d %s\n", page->width, page->height,
+            page->imageFileName.c_str());
+  }
+
+  for (size_t i = 0; i < manifest->sprites.size(); i++) {
+    SpriteRecord *sprite = &manifest->sprites[i];
+    fprintf(fp, "sprite %d %d %d %d %d %d %d %d %d %d %d %d %d %s\n",
+            sprite->input, sprite->page, sprite->left, sprite->top,
+            sprite->width, sprite->height, sprite->rotated, sprite->trimLeft,
+            sprite->trimTop, sprite->sourceWidth, sprite->sourceHeight,
+            sprite->slotWidth, sprite->slotHeight, sprite->name.c_str());
+  }
+
+  if (fclose(fp) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int Cache::statInput(const char *path, long long *mtime, long long *size)
+{
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return -1;
+  }
+
+  *mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  *size = st.st_size;
+  return 0;
+}
+
+int Cache::hashInput(const char *path, uint64_t *hash)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp) {
+    return -1;
+  }
+
+  char buf[65536];
+  size_t len;
+  *hash = 0;
+  while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    *hash = Hash::hash64(buf, len, *hash);
+  }
+
+  int err = ferror(fp) ? -1 : 0;
+  fclose(fp);
+  return err;
+}
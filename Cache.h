@@ -0,0 +1,65 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "TextureAtlas.h"
+
+/*
+ * The state of a previous run, stored next to its outputs so the next run
+ * can tell what changed.
+ */
+struct CacheManifest {
+
+  struct Input {
+    std::string path;
+    long long mtime; /* Nanoseconds */
+    long long size;
+    uint64_t hash;
+  };
+
+  struct Page {
+    std::string imageFileName;
+    int width, height;
+  };
+
+  /* Options that affect the output, runs must match to share a cache */
+  std::string signature;
+
+  std::vector<Input> inputs;
+  std::vector<Page> pages;
+  std::vector<SpriteRecord> sprites;
+};
+
+class Cache {
+
+public:
+  /*
+   * load() / save()
+   *
+   * Read or write a cache manifest file.
+   * Returns 0 on success, else error.
+   */
+  static int load(const char *fileName, CacheManifest *manifest);
+  static int save(const char *fileName, CacheManifest *manifest);
+
+  /*
+   * statInput()
+   *
+   * Get the modification time and size of an input file.
+   * Returns 0 on success, else error.
+   */
+  static int statInput(const char *path, long long *mtime, long long *size);
+
+  /*
+   * hashInput()
+   *
+   * Hash the content of an input file.
+   * Returns 0 on success, else error.
+   */
+  static int hashInput(const char *path, uint64_t *hash);
+};
+
+#endif
@@ -0,0 +1,704 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Compress.h"
+#include "Parallel.h"
+
+/* Pixels of a block, row by row, as R, G, B, A bytes */
+typedef uint8_t Block[16][4];
+
+static int clampByte(int value)
+{
+  return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static int square(int value) { return value * value; }
+
+static int getColorError(const uint8_t *a, const uint8_t *b)
+{
+  return square(a[0] - b[0]) + square(a[1] - b[1]) + square(a[2] - b[2]);
+}
+
+/*
+ * Find the line through a set of pixels (the first channels of each) that
+ * best fits them: the mean, and the ends of the pixels projected on the
+ * principal axis. Returns false if there are no pixels.
+ */
+static bool fitLine(const Block block, const bool *used, int channels,
+                    float *start, float *end)
+{
+  float mean[4] = {0, 0, 0, 0};
+  int count = 0;
+
+  for (int i = 0; i < 16; i++) {
+    if (used[i]) {
+      for (int c = 0; c < channels; c++) {
+        mean[c] += block[i][c];
+      }
+      count++;
+    }
+  }
+  if (count == 0) {
+    return false;
+  }
+  for (int c = 0; c < channels; c++) {
+    mean[c] /= count;
+  }
+
+  float cov[4][4];
+  memset(cov, 0, sizeof(cov));
+  for (int i = 0; i < 16; i++) {
+    if (!used[i]) {
+      continue;
+    }
+    for (int c = 0; c < channels; c++) {
+      for (int d = 0; d < channels; d++) {
+        cov[c][d] += (block[i][c] - mean[c]) * (block[i][d] - mean[d]);
+      }
+    }
+  }
+
+  /* Power iteration, starting from the diagonal */
+  float axis[4];
+  for (int c = 0; c < channels; c++) {
+    axis[c] = cov[c][c];
+  }
+  for (int iter = 0; iter < 8; iter++) {
+    float next[4] = {0, 0, 0, 0};
+    float length = 0;
+    for (int c = 0; c < channels; c++) {
+      for (int d = 0; d < channels; d++) {
+        next[c] += cov[c][d] * axis[d];
+      }
+      length += next[c] * next[c];
+    }
+    if (length < 1e-6f) {
+      break;
+    }
+    length = sqrtf(length);
+    for (int c = 0; c < channels; c++) {
+      axis[c] = next[c] / length;
+    }
+  }
+
+  float minT = 0, maxT = 0;
+  for (int i = 0; i < 16; i++) {
+    if (!used[i]) {
+      continue;
+    }
+    float t = 0;
+    for (int c = 0; c < channels; c++) {
+      t += (block[i][c] - mean[c]) * axis[c];
+    }
+    if (t < minT) {
+      minT = t;
+    }
+    if (t > maxT) {
+      maxT = t;
+    }
+  }
+
+  /* Inset the ends a little, the extremes are rarely hit exactly */
+  float inset = (maxT - minT) / 32;
+  minT += inset;
+  maxT -= inset;
+
+  for (int c = 0; c < channels; c++) {
+    start[c] = mean[c] + axis[c] * minT;
+    end[c] = mean[c] + axis[c] * maxT;
+  }
+  return true;
+}
+
+/*
+ * BC1 / BC3 color
+ */
+
+static uint16_t packRGB565(const float *color)
+{
+  int r = clampByte((int)(color[0] + 0.5f));
+  int g = clampByte((int)(color[1] + 0.5f));
+  int b = clampByte((int)(color[2] + 0.5f));
+  return ((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 |
+         ((b * 31 + 127) / 255);
+}
+
+static void unpackRGB565(uint16_t color, uint8_t *out)
+{
+  int r = (color >> 11) & 31;
+  int g = (color >> 5) & 63;
+  int b = color & 31;
+  out[0] = (r << 3) | (r >> 2);
+  out[1] = (g << 2) | (g >> 4);
+  out[2] = (b << 3) | (b >> 2);
+}
+
+/*
+ * Encode the color part of a BC1 or BC3 block. With allowTransparent,
+ * pixels with alpha below 128 use the transparent index of the three color
+ * mode.
+ */
+static void encodeColorBlock(const Block block, bool allowTransparent,
+                             uint8_t *out)
+{
+  bool used[16];
+  bool transparent = false;
+  for (int i = 0; i < 16; i++) {
+    used[i] = !allowTransparent || block[i][3] >= 128;
+    transparent = transparent || !used[i];
+  }
+
+  float start[4], end[4];
+  if (!fitLine(block, used, 3, start, end)) {
+    /* Fully transparent, both ends equal selects the three color mode */
+    memset(out, 0, 4);
+    memset(out + 4, 0xff, 4);
+    return;
+  }
+
+  uint16_t c0 = packRGB565(end);
+  uint16_t c1 = packRGB565(start);
+
+  /* The order of the ends selects the mode: c0 > c1 for four colors */
+  if (transparent ? c0 > c1 : c0 < c1) {
+    uint16_t tmp = c0;
+    c0 = c1;
+    c1 = tmp;
+  }
+
+  uint8_t palette[4][3];
+  int numColors = transparent ? 3 : 4;
+  unpackRGB565(c0, palette[0]);
+  unpackRGB565(c1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    if (transparent) {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+    } else {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+  }
+  if (c0 == c1) {
+    numColors = 1;
+  }
+
+  uint32_t indices = 0;
+  for (int i = 0; i < 16; i++) {
+    int best = 3;
+    if (used[i]) {
+      int bestError = getColorError(block[i], palette[0]);
+      best = 0;
+      for (int j = 1; j < numColors; j++) {
+        int error = getColorError(block[i], palette[j]);
+        if (error < bestError) {
+          bestError = error;
+          best = j;
+        }
+      }
+    }
+    indices |= (uint32_t)best << (2 * i);
+  }
+
+  out[0] = c0;
+  out[1] = c0 >> 8;
+  out[2] = c1;
+  out[3] = c1 >> 8;
+  for (int i = 0; i < 4; i++) {
+    out[4 + i] = indices >> (8 * i);
+  }
+}
+
+/*
+ * BC3 alpha: two ends and six values between them
+ */
+static void encodeAlphaBlock(const Block block, uint8_t *out)
+{
+  int a0 = 0, a1 = 255;
+  for (int i = 0; i < 16; i++) {
+    if (block[i][3] > a0) {
+      a0 = block[i][3];
+    }
+    if (block[i][3] < a1) {
+      a1 = block[i][3];
+    }
+  }
+
+  /* a0 > a1 selects the eight value mode, index 0 and 1 are the ends */
+  int palette[8];
+  palette[0] = a0;
+  palette[1] = a1;
+  for (int j = 1; j < 7; j++) {
+    palette[j + 1] = ((7 - j) * a0 + j * a1) / 7;
+  }
+
+  uint64_t indices = 0;
+  for (int i = 0; i < 16 && a0 > a1; i++) {
+    int best = 0;
+    int bestError = abs(block[i][3] - palette[0]);
+    for (int j = 1; j < 8; j++) {
+      int error = abs(block[i][3] - palette[j]);
+      if (error < bestError) {
+        bestError = error;
+        best = j;
+      }
+    }
+    indices |= (uint64_t)best << (3 * i);
+  }
+
+  out[0] = a0;
+  out[1] = a1;
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = indices >> (8 * i);
+  }
+}
+
+/*
+ * BC7 mode 6: one subset, RGBA ends of 7 bits plus a shared low bit each,
+ * and 4 bit indices
+ */
+
+static const int bc7Weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                   34, 38, 43, 47, 51, 55, 60, 64};
+
+/*
+ * Quantize an end to 7 bits per channel and the low bit that fits it best
+ */
+static void quantizeBC7End(const float *color, int *end, int *pBit)
+{
+  int bestError = -1;
+  for (int p = 0; p < 2; p++) {
+    int q[4];
+    int error = 0;
+    for (int c = 0; c < 4; c++) {
+      int v = clampByte((int)(color[c] + 0.5f));
+      q[c] = (v - p + 1) / 2;
+      if (q[c] > 127) {
+        q[c] = 127;
+      }
+      error += square(((q[c] << 1) | p) - v);
+    }
+    if (bestError < 0 || error < bestError) {
+      bestError = error;
+      *pBit = p;
+      memcpy(end, q, sizeof(q));
+    }
+  }
+}
+
+struct BitWriter {
+  uint8_t *out;
+  int pos;
+
+  void write(uint32_t value, int bits)
+  {
+    for (int i = 0; i < bits; i++, pos++) {
+      if (value & (1u << i)) {
+        out[pos >> 3] |= 1 << (pos & 7);
+      }
+    }
+  }
+};
+
+static void encodeBC7Block(const Block block, uint8_t *out)
+{
+  bool used[16];
+  for (int i = 0; i < 16; i++) {
+    used[i] = true;
+  }
+
+  float start[4], end[4];
+  fitLine(block, used, 4, start, end);
+
+  int ends[2][4], pBits[2];
+  quantizeBC7End(start, ends[0], &pBits[0]);
+  quantizeBC7End(end, ends[1], &pBits[1]);
+
+  int palette[16][4];
+  for (int j = 0; j < 16; j++) {
+    for (int c = 0; c < 4; c++) {
+      int e0 = (ends[0][c] << 1) | pBits[0];
+      int e1 = (ends[1][c] << 1) | pBits[1];
+      palette[j][c] =
+          ((64 - bc7Weights[j]) * e0 + bc7Weights[j] * e1 + 32) >> 6;
+    }
+  }
+
+  int indices[16];
+  for (int i = 0; i < 16; i++) {
+    int bestError = -1;
+    for (int j = 0; j < 16; j++) {
+      int error = 0;
+      for (int c = 0; c < 4; c++) {
+        error += square(block[i][c] - palette[j][c]);
+      }
+      if (bestError < 0 || error < bestError) {
+        bestError = error;
+        indices[i] = j;
+      }
+    }
+  }
+
+  /* The top bit of the first index is implied zero, swap the ends if set */
+  if (indices[0] & 8) {
+    for (int c = 0; c < 4; c++) {
+      int tmp = ends[0][c];
+      ends[0][c] = ends[1][c];
+      ends[1][c] = tmp;
+    }
+    int tmp = pBits[0];
+    pBits[0] = pBits[1];
+    pBits[1] = tmp;
+    for (int i = 0; i < 16; i++) {
+      indices[i] = 15 - indices[i];
+    }
+  }
+
+  memset(out, 0, 16);
+  BitWriter writer = {out, 0};
+  writer.write(1 << 6, 7);
+  for (int c = 0; c < 4; c++) {
+    writer.write(ends[0][c], 7);
+    writer.write(ends[1][c], 7);
+  }
+  writer.write(pBits[0], 1);
+  writer.write(pBits[1], 1);
+  writer.write(indices[0], 3);
+  for (int i = 1; i < 16; i++) {
+    writer.write(indices[i], 4);
+  }
+}
+
+/*
+ * ETC2 RGB, using the individual and differential modes it shares with
+ * ETC1. Pixels are numbered column by column.
+ */
+
+/* In the order of the index bits: +a, +b, -a, -b */
+static const int etcModifiers[8][4] = {
+    {2, 8, -2, -8},       {5, 17, -5, -17},     {9, 29, -9, -29},
+    {13, 42, -13, -42},   {18, 60, -18, -60},   {24, 80, -24, -80},
+    {33, 106, -33, -106}, {47, 183, -47, -183},
+};
+
+/*
+ * Find the modifier table and indices that fit a sub-block best to the
+ * given base color. Returns the error.
+ */
+static int fitEtcSubBlock(const Block block, const int *pixels,
+                          const int *base, int *table, int *indices)
+{
+  int bestError = -1;
+  for (int t = 0; t < 8; t++) {
+    int error = 0;
+    int tIndices[8];
+    for (int i = 0; i < 8; i++) {
+      const uint8_t *pixel = block[pixels[i]];
+      int best = 0, bestPixelError = -1;
+      for (int j = 0; j < 4; j++) {
+        int pixelError = 0;
+        for (int c = 0; c < 3; c++) {
+          pixelError +=
+              square(pixel[c] - clampByte(base[c] + etcModifiers[t][j]));
+        }
+        if (bestPixelError < 0 || pixelError < bestPixelError) {
+          bestPixelError = pixelError;
+          best = j;
+        }
+      }
+      tIndices[i] = best;
+      error += bestPixelError;
+    }
+    if (bestError < 0 || error < bestError) {
+      bestError = error;
+      *table = t;
+      memcpy(indices, tIndices, sizeof(tIndices));
+    }
+  }
+  return bestError;
+}
+
+static void putBigEndian64(uint64_t value, uint8_t *out)
+{
+  for (int i = 0; i < 8; i++) {
+    out[i] = value >> (56 - 8 * i);
+  }
+}
+
+static void encodeEtcColorBlock(const Block block, uint8_t *out)
+{
+  uint64_t bestBits = 0;
+  int bestError = -1;
+
+  for (int flip = 0; flip < 2; flip++) {
+
+    /* Pixels (block indices) of each sub-block, and their ETC number */
+    int pixels[2][8], numbers[2][8];
+    int n[2] = {0, 0};
+    for (int x = 0; x < 4; x++) {
+      for (int y = 0; y < 4; y++) {
+        int sub = flip ? (y >= 2) : (x >= 2);
+        pixels[sub][n[sub]] = y * 4 + x;
+        numbers[sub][n[sub]] = x * 4 + y;
+        n[sub]++;
+      }
+    }
+
+    /* Average color of each sub-block, at 4 and 5 bits */
+    int avg4[2][3], avg5[2][3];
+    for (int s = 0; s < 2; s++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = 0;
+        for (int i = 0; i < 8; i++) {
+          sum += block[pixels[s][i]][c];
+        }
+        avg4[s][c] = (sum * 15 + 8 * 255 / 2) / (8 * 255);
+        avg5[s][c] = (sum * 31 + 8 * 255 / 2) / (8 * 255);
+      }
+    }
+
+    bool differential = true;
+    for (int c = 0; c < 3; c++) {
+      int delta = avg5[1][c] - avg5[0][c];
+      differential = differential && delta >= -4 && delta <= 3;
+    }
+
+    int base[2][3];
+    for (int s = 0; s < 2; s++) {
+      for (int c = 0; c < 3; c++) {
+        base[s][c] = differential ? (avg5[s][c] << 3) | (avg5[s][c] >> 2)
+                                  : avg4[s][c] * 17;
+      }
+    }
+
+    int tables[2], indices[2][8];
+    int error = fitEtcSubBlock(block, pixels[0], base[0], &tables[0],
+                               indices[0]) +
+                fitEtcSubBlock(block, pixels[1], base[1], &tables[1],
+                               indices[1]);
+    if (bestError >= 0 && error >= bestError) {
+      continue;
+    }
+    bestError = error;
+
+    uint64_t bits = 0;
+    for (int c = 0; c < 3; c++) {
+      int shift = 59 - 8 * c;
+      if (differential) {
+        bits |= (uint64_t)avg5[0][c] << shift;
+        bits |= (uint64_t)((avg5[1][c] - avg5[0][c]) & 7) << (shift - 3);
+      } else {
+        bits |= (uint64_t)avg4[0][c] << (shift + 1);
+        bits |= (uint64_t)avg4[1][c] << (shift - 3);
+      }
+    }
+    bits |= (uint64_t)tables[0] << 37;
+    bits |= (uint64_t)tables[1] << 34;
+    bits |= (uint64_t)differential << 33;
+    bits |= (uint64_t)flip << 32;
+
+    /* Modifier index bits go to an MSB and an LSB plane */
+    for (int s = 0; s < 2; s++) {
+      for (int i = 0; i < 8; i++) {
+        int code = indices[s][i];
+        int number = numbers[s][i];
+        bits |= (uint64_t)(code >> 1) << (16 + number);
+        bits |= (uint64_t)(code & 1) << number;
+      }
+    }
+    bestBits = bits;
+  }
+
+  putBigEndian64(bestBits, out);
+}
+
+/*
+ * EAC alpha: a base value plus a scaled modifier from one of 16 tables
+ */
+
+static const int eacModifiers[16][8] = {
+    {-3, -6, -9, -15, 2, 5, 8, 14}, {-3, -7, -10, -13, 2, 6, 9, 12},
+    {-2, -5, -8, -13, 1, 4, 7, 12}, {-2, -4, -6, -13, 1, 3, 5, 12},
+    {-3, -6, -8, -12, 2, 5, 7, 11}, {-3, -7, -9, -11, 2, 6, 8, 10},
+    {-4, -7, -8, -11, 3, 6, 7, 10}, {-3, -5, -8, -11, 2, 4, 7, 10},
+    {-2, -6, -8, -10, 1, 5, 7, 9},  {-2, -5, -8, -10, 1, 4, 7, 9},
+    {-2, -4, -8, -10, 1, 3, 7, 9},  {-2, -5, -7, -10, 1, 4, 6, 9},
+    {-3, -4, -7, -10, 2, 3, 6, 9},  {-1, -2, -3, -10, 0, 1, 2, 9},
+    {-4, -6, -8, -9, 3, 5, 7, 8},   {-3, -5, -7, -9, 2, 4, 6, 8},
+};
+
+static void encodeEacAlphaBlock(const Block block, uint8_t *out)
+{
+  int minA = 255, maxA = 0;
+  for (int i = 0; i < 16; i++) {
+    if (block[i][3] < minA) {
+      minA = block[i][3];
+    }
+    if (block[i][3] > maxA) {
+      maxA = block[i][3];
+    }
+  }
+
+  /* Constant alpha is exact with the zero modifier of table 13 */
+  int bestBase = minA, bestMul = 1, bestTable = 13;
+  int bestIndices[16];
+  for (int i = 0; i < 16; i++) {
+    bestIndices[i] = 4;
+  }
+
+  if (minA != maxA) {
+    int bestError = -1;
+    for (int t = 0; t < 16; t++) {
+      const int *mod = eacModifiers[t];
+      int span = mod[7] - mod[3];
+      int mul0 = (maxA - minA + span / 2) / span;
+
+      /* Only multipliers close to the one spanning the range */
+      for (int mul = mul0 - 1; mul <= mul0 + 1; mul++) {
+        if (mul < 1 || mul > 15) {
+          continue;
+        }
+        int base =
+            clampByte((minA - mod[3] * mul + maxA - mod[7] * mul + 1) / 2);
+        int error = 0;
+        int indices[16];
+        for (int i = 0; i < 16 && (bestError < 0 || error < bestError);
+             i++) {
+          int bestPixelError = -1;
+          for (int j = 0; j < 8; j++) {
+            int pixelError =
+                square(block[i][3] - clampByte(base + mod[j] * mul));
+            if (bestPixelError < 0 || pixelError < bestPixelError) {
+              bestPixelError = pixelError;
+              indices[i] = j;
+            }
+          }
+          error += bestPixelError;
+        }
+        if (bestError < 0 || error < bestError) {
+          bestError = error;
+          bestBase = base;
+          bestMul = mul;
+          bestTable = t;
+          memcpy(bestIndices, indices, sizeof(indices));
+        }
+      }
+    }
+  }
+
+  uint64_t bits = (uint64_t)bestBase << 56 | (uint64_t)bestMul << 52 |
+                  (uint64_t)bestTable << 48;
+  for (int x = 0; x < 4; x++) {
+    for (int y = 0; y < 4; y++) {
+      int number = x * 4 + y;
+      bits |= (uint64_t)bestIndices[y * 4 + x] << (45 - 3 * number);
+    }
+  }
+  putBigEndian64(bits, out);
+}
+
+int Compress::getFormatByName(const char *name)
+{
+  static const char *names[] = {"bc1", "bc3", "bc7", "etc2"};
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int Compress::getBlockBytes(Format format)
+{
+  return format == FormatBC1 ? 8 : 16;
+}
+
+size_t Compress::getSize(Format format, int width, int height)
+{
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) *
+         getBlockBytes(format);
+}
+
+struct EncodeParams {
+  Compress::Format format;
+  const uint8_t *pixels;
+  int pitch;
+  int width, height;
+  int blocksWide;
+  uint8_t *out;
+};
+
+/*
+ * Get the pixels of a block, repeating the last column and row of the
+ * image in blocks past its edges
+ */
+static void getBlock(struct EncodeParams *params, int bx, int by,
+                     Block block)
+{
+  int x0 = bx * 4;
+  int y0 = by * 4;
+
+  if (x0 + 4 <= params->width && y0 + 4 <= params->height) {
+    for (int y = 0; y < 4; y++) {
+      memcpy(block[y * 4],
+             params->pixels + (size_t)(y0 + y) * params->pitch + x0 * 4, 16);
+    }
+    return;
+  }
+
+  for (int y = 0; y < 4; y++) {
+    int sy = y0 + y < params->height ? y0 + y : params->height - 1;
+    for (int x = 0; x < 4; x++) {
+      int sx = x0 + x < params->width ? x0 + x : params->width - 1;
+      memcpy(block[y * 4 + x],
+             params->pixels + (size_t)sy * params->pitch + sx * 4, 4);
+    }
+  }
+}
+
+/*
+ * Encode one row of blocks
+ */
+static void encodeRow(int row, int worker, void *param)
+{
+  struct EncodeParams *params = (struct EncodeParams *)param;
+  int blockBytes = Compress::getBlockBytes(params->format);
+  uint8_t *out = params->out + (size_t)row * params->blocksWide * blockBytes;
+  Block block;
+
+  for (int bx = 0; bx < params->blocksWide; bx++, out += blockBytes) {
+    getBlock(params, bx, row, block);
+
+    switch (params->format) {
+    case Compress::FormatBC1:
+      encodeColorBlock(block, true, out);
+      break;
+    case Compress::FormatBC3:
+      encodeAlphaBlock(block, out);
+      encodeColorBlock(block, false, out + 8);
+      break;
+    case Compress::FormatBC7:
+      encodeBC7Block(block, out);
+      break;
+    case Compress::FormatETC2:
+      encodeEacAlphaBlock(block, out);
+      encodeEtcColorBlock(block, out + 8);
+      break;
+    }
+  }
+}
+
+void Compress::encode(Format format, const uint32_t *pixels, int pitch,
+                      int width, int height, uint8_t *out, int jobs)
+{
+  struct EncodeParams params;
+  params.format = format;
+  params.pixels = (const uint8_t *)pixels;
+  params.pitch = pitch;
+  params.width = width;
+  params.height = height;
+  params.blocksWide = (width + 3) / 4;
+  params.out = out;
+
+  Parallel::forEach((height + 3) / 4, jobs, encodeRow, &params);
+}
@@ -0,0 +1,53 @@
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Compress {
+
+public:
+  /* GPU block compressed formats, all with 4x4 pixel blocks */
+  enum Format {
+    FormatBC1,  /* RGB with 1 bit alpha, 8 bytes per block */
+    FormatBC3,  /* RGBA with interpolated alpha, 16 bytes per block */
+    FormatBC7,  /* RGBA (mode 6 only), 16 bytes per block */
+    FormatETC2, /* ETC2 RGB with EAC alpha, 16 bytes per block */
+  };
+
+  /*
+   * getFormatByName()
+   *
+   * Format by its command line name (bc1, bc3, bc7, etc2).
+   * Returns -1 if unknown.
+   */
+  static int getFormatByName(const char *name);
+
+  /*
+   * getBlockBytes()
+   *
+   * Size in bytes of one 4x4 block in the given format.
+   */
+  static int getBlockBytes(Format format);
+
+  /*
+   * getSize()
+   *
+   * Size in bytes of an image of the given size once compressed.
+   */
+  static size_t getSize(Format format, int width, int height);
+
+  /*
+   * encode()
+   *
+   * Compress 32 bit RGBA pixels (red in the lowest byte in memory) into
+   * out, which must hold getSize() bytes. Blocks are stored row by row.
+   * Blocks past the right or bottom edge repeat the last column or row,
+   * pitch is in bytes. Rows of blocks are shared out to jobs threads, see
+   * Parallel.
+   */
+  static void encode(Format format, const uint32_t *pixels, int pitch,
+                     int width, int height, uint8_t *out, int jobs);
+};
+
+#endif
@@ -0,0 +1,348 @@
+#include <string.h>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Convert.h"
+#include "Parallel.h"
+#include "Pixels.h"
+
+/* Rows each job converts at a time */
+#define BAND_HEIGHT 32
+
+/*
+ * 4x4 Bayer matrix as rounding biases for quantize(): (2 * b + 1) * 255 /
+ * 32 for threshold b, spread around the 127 of plain rounding
+ */
+static const int orderedBias[4][4] = {
+    {7, 135, 39, 167},
+    {199, 71, 231, 103},
+    {55, 183, 23, 151},
+    {247, 119, 215, 87},
+};
+
+static const int nearestBias[4] = {127, 127, 127, 127};
+
+/* x / 255 for 0 <= x < 65535 */
+static int divide255(int x) { return (x + 1 + (x >> 8)) >> 8; }
+
+/*
+ * Channel value 0-255 as a level 0-maxLevel, rounded up from bias / 255 of
+ * a level
+ */
+static int quantize(int value, int maxLevel, int bias)
+{
+  return divide255(value * maxLevel + bias);
+}
+
+static void putUint16(uint8_t *out, int value)
+{
+  out[0] = value;
+  out[1] = value >> 8;
+}
+
+struct ConvertParams {
+  Convert::Format format;
+  Convert::Dither dither;
+  const uint32_t *pixels;
+  int pitch;
+  int width, height;
+  uint8_t *out;
+  int outPitch;
+
+  /* Of the R, G, B and A channels, 0 for channels left out */
+  int maxLevels[4];
+  int shifts[4];
+};
+
+#ifdef __SSE2__
+/*
+ * Quantize two pixels, unpacked to 16 bit lanes, and shift their channels
+ * into place. The pixels are in 32 bit lanes 0 and 2 of the result.
+ */
+static __m128i packPair(__m128i pixels, __m128i maxLevels, __m128i bias,
+                        __m128i shifts)
+{
+  const __m128i one = _mm_set1_epi16(1);
+  __m128i x = _mm_add_epi16(_mm_mullo_epi16(pixels, maxLevels), bias);
+  __m128i q = _mm_srli_epi16(
+      _mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+  __m128i sums = _mm_madd_epi16(q, shifts);
+  return _mm_add_epi32(sums, _mm_srli_epi64(sums, 32));
+}
+
+/* Four pixels from packPair() of pixels 0-1 and 2-3, in 32 bit lanes */
+static __m128i joinPairs(__m128i low, __m128i high)
+{
+  return _mm_unpacklo_epi64(_mm_shuffle_epi32(low, _MM_SHUFFLE(3, 1, 2, 0)),
+                            _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 1, 2, 0)));
+}
+#endif
+
+/*
+ * Convert a row to a 16 bit format, rounding to the nearest level or with
+ * ordered dithering
+ */
+static void quantizeRow(struct ConvertParams *params, int y)
+{
+  const uint32_t *row = getRow(params->pixels, params->pitch, y);
+  uint8_t *out = params->out + (size_t)y * params->outPitch;
+  const int *bias = params->dither == Convert::DitherOrdered
+                        ? orderedBias[y & 3]
+                        : nearestBias;
+  const int *maxLevels = params->maxLevels;
+  const int *shifts = params->shifts;
+  int x = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i offset = _mm_set1_epi32(0x8000);
+  const __m128i levels =
+      _mm_setr_epi16(maxLevels[0], maxLevels[1], maxLevels[2], maxLevels[3],
+                     maxLevels[0], maxLevels[1], maxLevels[2], maxLevels[3]);
+  const __m128i places = _mm_setr_epi16(
+      1 << shifts[0], 1 << shifts[1], 1 << shifts[2], 1 << shifts[3],
+      1 << shifts[0], 1 << shifts[1], 1 << shifts[2], 1 << shifts[3]);
+  const __m128i bias01 = _mm_setr_epi16(bias[0], bias[0], bias[0], bias[0],
+                                        bias[1], bias[1], bias[1], bias[1]);
+  const __m128i bias23 = _mm_setr_epi16(bias[2], bias[2], bias[2], bias[2],
+                                        bias[3], bias[3], bias[3], bias[3]);
+
+  /* x stays a multiple of 4, so the biases line up with the pixels */
+  for (; x + 8 <= params->width; x += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(row + x));
+    __m128i b = _mm_loadu_si128((const __m128i *)(row + x + 4));
+    __m128i low = joinPairs(
+        packPair(_mm_unpacklo_epi8(a, zero), levels, bias01, places),
+        packPair(_mm_unpackhi_epi8(a, zero), levels, bias23, places));
+    __m128i high = joinPairs(
+        packPair(_mm_unpacklo_epi8(b, zero), levels, bias01, places),
+        packPair(_mm_unpackhi_epi8(b, zero), levels, bias23, places));
+
+    /* Signed saturation leaves values below 0x8000 alone */
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(low, offset),
+                                     _mm_sub_epi32(high, offset));
+    packed = _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000));
+    _mm_storeu_si128((__m128i *)(out + 2 * x), packed);
+  }
+#endif
+
+  for (; x < params->width; x++) {
+    int value = 0;
+    for (int c = 0; c < 4; c++) {
+      int channel = (row[x] >> (8 * c)) & 0xff;
+      value |= quantize(channel, maxLevels[c], bias[x & 3]) << shifts[c];
+    }
+    putUint16(out + 2 * x, value);
+  }
+}
+
+/*
+ * Convert rows to a 16 bit format with Floyd-Steinberg error diffusion.
+ * Errors are kept in 1/16ths, for each channel of the pixels of the row
+ * and the next one, with a pixel of room on either side.
+ */
+static void diffuseRows(struct ConvertParams *params, int startY, int endY)
+{
+  int width = params->width;
+  std::vector<int> errors(2 * (width + 2) * 4, 0);
+  int *current = &errors[4];
+  int *next = &errors[(width + 2) * 4 + 4];
+
+  for (int y = startY; y < endY; y++) {
+    const uint32_t *row = getRow(params->pixels, params->pitch, y);
+    uint8_t *out = params->out + (size_t)y * params->outPitch;
+
+    for (int x = 0; x < width; x++) {
+      int value = 0;
+      for (int c = 0; c < 4; c++) {
+        int maxLevel = params->maxLevels[c];
+        if (!maxLevel) {
+          continue;
+        }
+
+        int channel =
+            ((row[x] >> (8 * c)) & 0xff) + current[x * 4 + c] / 16;
+        channel = channel < 0 ? 0 : (channel > 255 ? 255 : channel);
+        int level = quantize(channel, maxLevel, 127);
+        int error = channel - (level * 255 + maxLevel / 2) / maxLevel;
+
+        current[(x + 1) * 4 + c] += 7 * error;
+        next[(x - 1) * 4 + c] += 3 * error;
+        next[x * 4 + c] += 5 * error;
+        next[(x + 1) * 4 + c] += error;
+        value |= level << params->shifts[c];
+      }
+      putUint16(out + 2 * x, value);
+    }
+
+    int *done = current;
+    current = next;
+    next = done;
+    memset(next - 4, 0, (width + 2) * 4 * sizeof(int));
+  }
+}
+
+/* Keep the alpha of each pixel of a row */
+static void alphaRow(struct ConvertParams *params, int y)
+{
+  const uint32_t *row = getRow(params->pixels, params->pitch, y);
+  uint8_t *out = params->out + (size_t)y * params->outPitch;
+  int x = 0;
+
+#ifdef __SSE2__
+  for (; x + 16 <= params->width; x += 16) {
+    __m128i a = _mm_srli_epi32(_mm_loadu_si128((const __m128i *)(row + x)),
+                               24);
+    __m128i b = _mm_srli_epi32(
+        _mm_loadu_si128((const __m128i *)(row + x + 4)), 24);
+    __m128i c = _mm_srli_epi32(
+        _mm_loadu_si128((const __m128i *)(row + x + 8)), 24);
+    __m128i d = _mm_srli_epi32(
+        _mm_loadu_si128((const __m128i *)(row + x + 12)), 24);
+    _mm_storeu_si128((__m128i *)(out + x),
+                     _mm_packus_epi16(_mm_packs_epi32(a, b),
+                                      _mm_packs_epi32(c, d)));
+  }
+#endif
+
+  for (; x < params->width; x++) {
+    out[x] = row[x] >> 24;
+  }
+}
+
+static void convertBand(int band, int worker, void *param)
+{
+  struct ConvertParams *params = (struct ConvertParams *)param;
+  int startY = band * BAND_HEIGHT;
+  int endY = startY + BAND_HEIGHT;
+  if (endY > params->height) {
+    endY = params->height;
+  }
+
+  switch (params->format) {
+  case Convert::FormatRGBA8888:
+    for (int y = startY; y < endY; y++) {
+      memcpy(params->out + (size_t)y * params->outPitch,
+             getRow(params->pixels, params->pitch, y), params->outPitch);
+    }
+    break;
+  case Convert::FormatA8:
+    for (int y = startY; y < endY; y++) {
+      alphaRow(params, y);
+    }
+    break;
+  default:
+    if (params->dither == Convert::DitherDiffusion) {
+      diffuseRows(params, startY, endY);
+    } else {
+      for (int y = startY; y < endY; y++) {
+        quantizeRow(params, y);
+      }
+    }
+    break;
+  }
+}
+
+int Convert::getFormatByName(const char *name)
+{
+  static const char *names[] = {"rgba8888", "rgba4444", "rgb565", "a8"};
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int Convert::getDitherByName(const char *name)
+{
+  static const char *names[] = {"none", "ordered", "diffusion"};
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int Convert::getPixelBytes(Format format)
+{
+  return format == FormatRGBA8888 ? 4 : (format == FormatA8 ? 1 : 2);
+}
+
+size_t Convert::getSize(Format format, int width, int height)
+{
+  return (size_t)width * height * getPixelBytes(format);
+}
+
+void Convert::convert(Format format, Dither dither, const uint32_t *pixels,
+                      int pitch, int width, int height, uint8_t *out,
+                      int jobs)
+{
+  static const int maxLevels4444[4] = {15, 15, 15, 15};
+  static const int shifts4444[4] = {8, 4, 0, 12};
+  static const int maxLevels565[4] = {31, 63, 31, 0};
+  static const int shifts565[4] = {11, 5, 0, 0};
+
+  struct ConvertParams params;
+  params.format = format;
+  params.dither = dither;
+  params.pixels = pixels;
+  params.pitch = pitch;
+  params.width = width;
+  params.height = height;
+  params.out = out;
+  params.outPitch = width * getPixelBytes(format);
+  bool is4444 = format == FormatRGBA4444;
+  memcpy(params.maxLevels, is4444 ? maxLevels4444 : maxLevels565,
+         sizeof(params.maxLevels));
+  memcpy(params.shifts, is4444 ? shifts4444 : shifts565,
+         sizeof(params.shifts));
+
+  Parallel::forEach((height + BAND_HEIGHT - 1) / BAND_HEIGHT, jobs,
+                    convertBand, &params);
+}
+
+void Convert::premultiply(uint32_t *pixels, int pitch, int width, int height)
+{
+  for (int y = 0; y < height; y++) {
+    uint32_t *row = getRow(pixels, pitch, y);
+    int x = 0;
+
+#ifdef __SSE2__
+    /* Alpha itself is multiplied by 255, which keeps it */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(128);
+    const __m128i colorMask = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+    const __m128i alphaOnly = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    for (; x + 4 <= width; x += 4) {
+      __m128i p = _mm_loadu_si128((const __m128i *)(row + x));
+      __m128i halves[2] = {_mm_unpacklo_epi8(p, zero),
+                           _mm_unpackhi_epi8(p, zero)};
+      for (int i = 0; i < 2; i++) {
+        __m128i alpha = _mm_shufflehi_epi16(
+            _mm_shufflelo_epi16(halves[i], _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+        alpha = _mm_or_si128(_mm_and_si128(alpha, colorMask), alphaOnly);
+        __m128i v = _mm_add_epi16(_mm_mullo_epi16(halves[i], alpha), round);
+        halves[i] = _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+      }
+      _mm_storeu_si128((__m128i *)(row + x),
+                       _mm_packus_epi16(halves[0], halves[1]));
+    }
+#endif
+
+    for (; x < width; x++) {
+      uint32_t alpha = row[x] >> 24;
+      uint32_t result = row[x] & 0xff000000;
+      for (int c = 0; c < 3; c++) {
+        int v = ((row[x] >> (8 * c)) & 0xff) * alpha + 128;
+        result |= (uint32_t)((v + (v >> 8)) >> 8) << (8 * c);
+      }
+      row[x] = result;
+    }
+  }
+}
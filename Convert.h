@@ -0,0 +1,77 @@
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Convert {
+
+public:
+  /*
+   * Uncompressed pixel formats. The 16 bit formats are stored little endian
+   * with the channels in the bits given, the layouts of the DDS (D3D)
+   * formats of the same names.
+   */
+  enum Format {
+    FormatRGBA8888, /* R, G, B, A bytes, as drawn */
+    FormatRGBA4444, /* A 15-12, R 11-8, G 7-4, B 3-0 */
+    FormatRGB565,   /* R 15-11, G 10-5, B 4-0, alpha dropped */
+    FormatA8,       /* Alpha only, one byte */
+  };
+
+  /* How channels are rounded to fewer bits */
+  enum Dither {
+    DitherNone,      /* To the nearest level */
+    DitherOrdered,   /* With a 4x4 Bayer threshold matrix */
+    DitherDiffusion, /* With Floyd-Steinberg error diffusion */
+  };
+
+  /*
+   * getFormatByName()
+   *
+   * Format by its command line name (rgba8888, rgba4444, rgb565, a8).
+   * Returns -1 if unknown.
+   */
+  static int getFormatByName(const char *name);
+
+  /*
+   * getDitherByName()
+   *
+   * Dithering by its command line name (none, ordered, diffusion).
+   * Returns -1 if unknown.
+   */
+  static int getDitherByName(const char *name);
+
+  static int getPixelBytes(Format format);
+
+  /*
+   * getSize()
+   *
+   * Size in bytes of an image of the given size in a format, rows tightly
+   * packed.
+   */
+  static size_t getSize(Format format, int width, int height);
+
+  /*
+   * convert()
+   *
+   * Convert 32 bit RGBA pixels (red in the lowest byte in memory) into
+   * out, which must hold getSize() bytes. Pitch is in bytes. Bands of rows
+   * are shared out to jobs threads, see Parallel. Error diffusion starts
+   * over in each band, so the result does not depend on jobs.
+   */
+  static void convert(Format format, Dither dither, const uint32_t *pixels,
+                      int pitch, int width, int height, uint8_t *out,
+                      int jobs);
+
+  /*
+   * premultiply()
+   *
+   * Multiply the color channels of 32 bit RGBA pixels by their alpha, in
+   * place. Pitch is in bytes.
+   */
+  static void premultiply(uint32_t *pixels, int pitch, int width,
+                          int height);
+};
+
+#endif
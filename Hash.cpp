@@ -0,0 +1,43 @@
+#include <string.h>
+
+#include "Hash.h"
+
+static const uint64_t prime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t prime2 = 0xc2b2ae3d27d4eb4fULL;
+
+static uint64_t rotl64(uint64_t value, int bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t mix(uint64_t hash, uint64_t value)
+{
+  hash ^= rotl64(value * prime2, 31) * prime1;
+  return rotl64(hash, 27) * prime1 + prime2;
+}
+
+uint64_t Hash::hash64(const void *data, size_t len, uint64_t seed)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  uint64_t hash = seed + prime1 + len;
+
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    hash = mix(hash, value);
+  }
+
+  if (len > 0) {
+    uint64_t value = 0;
+    memcpy(&value, p, len);
+    hash = mix(hash, value);
+  }
+
+  /* Final avalanche */
+  hash ^= hash >> 33;
+  hash *= prime2;
+  hash ^= hash >> 29;
+  hash *= prime1;
+  hash ^= hash >> 32;
+  return hash;
+}
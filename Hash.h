@@ -0,0 +1,19 @@
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Hash {
+
+public:
+  /*
+   * hash64()
+   *
+   * Fast non-cryptographic 64 bit hash of a block of memory, eight bytes
+   * at a time. Chain calls by passing the previous hash as seed.
+   */
+  static uint64_t hash64(const void *data, size_t len, uint64_t seed = 0);
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include <limits.h>
+#include <stdio.h>
+
+#include "Packer.h"
+
+using namespace Atlas;
+
+/*
+ * MaxRects packer
+ *
+ * Keeps a list of the maximal free rectangles (which may overlap each
+ * other). Each new rectangle goes to the free rectangle that scores best
+ * for the heuristic, then every free rectangle it intersects is split
+ * into the parts left around it and free rectangles contained in others
+ * are dropped.
+ */
+
+void MaxRectsPacker::reset(int width, int height, int numRects)
+{
+  mWidth = width;
+  mHeight = height;
+
+  Rect rect = {0, 0, width, height};
+  mFreeRects.clear();
+  mFreeRects.push_back(rect);
+  mPlacements.clear();
+  mPlacements.reserve(numRects);
+}
+
+/*
+ * Find the free rectangle where a w x h rectangle scores best. Only
+ * updates the best index and scores if better than the ones given.
+ */
+bool MaxRectsPacker::findPosition(int w, int h, int *bestIndex,
+                                  int *bestScore1, int *bestScore2)
+{
+  bool found = false;
+
+  for (size_t i = 0; i < mFreeRects.size(); i++) {
+    const Rect &freeRect = mFreeRects[i];
+    if (w > freeRect.width || h > freeRect.height) {
+      continue;
+    }
+
+    int leftoverW = freeRect.width - w;
+    int leftoverH = freeRect.height - h;
+    int shortSide = leftoverW < leftoverH ? leftoverW : leftoverH;
+    int longSide = leftoverW < leftoverH ? leftoverH : leftoverW;
+    int score1, score2;
+
+    if (mHeuristic == BestAreaFit) {
+      score1 = freeRect.width * freeRect.height - w * h;
+      score2 = shortSide;
+    } else {
+      score1 = shortSide;
+      score2 = longSide;
+    }
+
+    if (score1 < *bestScore1 ||
+        (score1 == *bestScore1 && score2 < *bestScore2)) {
+      *bestIndex = i;
+      *bestScore1 = score1;
+      *bestScore2 = score2;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+bool MaxRectsPacker::insert(NodeRect *rect)
+{
+  int w = rect->getWidth();
+  int h = rect->getHeight();
+  int bestIndex = -1;
+  int bestScore1 = INT_MAX;
+  int bestScore2 = INT_MAX;
+  bool rotated = false;
+
+  findPosition(w, h, &bestIndex, &bestScore1, &bestScore2);
+  if (mAllowRotate && w != h &&
+      findPosition(h, w, &bestIndex, &bestScore1, &bestScore2)) {
+    rotated = true;
+    w = rect->getHeight();
+    h = rect->getWidth();
+  }
+
+  if (bestIndex < 0) {
+    return false;
+  }
+
+  Rect used = {mFreeRects[bestIndex].left, mFreeRects[bestIndex].top, w, h};
+
+  /* Split every free rectangle the new one overlaps */
+  mNewFreeRects.clear();
+  for (size_t i = 0; i < mFreeRects.size(); i++) {
+    if (!splitFreeRect(mFreeRects[i], used)) {
+      mNewFreeRects.push_back(mFreeRects[i]);
+    }
+  }
+  mFreeRects.swap(mNewFreeRects);
+  pruneFreeList();
+
+  Placement placement = {rect, used.left, used.top, w, h, rotated};
+  mPlacements.push_back(placement);
+  return true;
+}
+
+/*
+ * Add the parts of freeRect not covered by usedRect to the new free list.
+ * Returns false (and adds nothing) if the two do not intersect.
+ */
+bool MaxRectsPacker::splitFreeRect(const Rect &freeRect, const Rect &usedRect)
+{
+  if (usedRect.left >= freeRect.left + freeRect.width ||
+      usedRect.left + usedRect.width <= freeRect.left ||
+      usedRect.top >= freeRect.top + freeRect.height ||
+      usedRect.top + usedRect.height <= freeRect.top) {
+    return false;
+  }
+
+  if (usedRect.top > freeRect.top) {
+    /* Part above */
+    Rect rect = freeRect;
+    rect.height = usedRect.top - freeRect.top;
+    mNewFreeRects.push_back(rect);
+  }
+  if (usedRect.top + usedRect.height < freeRect.top + freeRect.height) {
+    /* Part below */
+    Rect rect = freeRect;
+    rect.top = usedRect.top + usedRect.height;
+    rect.height = freeRect.top + freeRect.height - rect.top;
+    mNewFreeRects.push_back(rect);
+  }
+  if (usedRect.left > freeRect.left) {
+    /* Part to the left */
+    Rect rect = freeRect;
+    rect.width = usedRect.left - freeRect.left;
+    mNewFreeRects.push_back(rect);
+  }
+  if (usedRect.left + usedRect.width < freeRect.left + freeRect.width) {
+    /* Part to the right */
+    Rect rect = freeRect;
+    rect.left = usedRect.left + usedRect.width;
+    rect.width = freeRect.left + freeRect.width - rect.left;
+    mNewFreeRects.push_back(rect);
+  }
+
+  return true;
+}
+
+static bool isContainedIn(int l1, int t1, int w1, int h1, int l2, int t2,
+                          int w2, int h2)
+{
+  return l1 >= l2 && t1 >= t2 && l1 + w1 <= l2 + w2 && t1 + h1 <= t2 + h2;
+}
+
+/*
+ * Drop free rectangles that are fully covered by another free rectangle
+ */
+void MaxRectsPacker::pruneFreeList()
+{
+  size_t num = mFreeRects.size();
+  std::vector<char> removed(num, 0);
+
+  for (size_t i = 0; i < num; i++) {
+    if (removed[i]) {
+      continue;
+    }
+    const Rect &a = mFreeRects[i];
+    for (size_t j = i + 1; j < num; j++) {
+      if (removed[j]) {
+        continue;
+      }
+      const Rect &b = mFreeRects[j];
+      if (isContainedIn(a.left, a.top, a.width, a.height, b.left, b.top,
+                        b.width, b.height)) {
+        removed[i] = 1;
+        break;
+      }
+      if (isContainedIn(b.left, b.top, b.width, b.height, a.left, a.top,
+                        a.width, a.height)) {
+        removed[j] = 1;
+      }
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < num; i++) {
+    if (!removed[i]) {
+      mFreeRects[kept++] = mFreeRects[i];
+    }
+  }
+  mFreeRects.resize(kept);
+}
+
+void MaxRectsPacker::getPlacements(std::vector<Placement> *placements)
+{
+  *placements = mPlacements;
+}
@@ -0,0 +1,143 @@
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Mip.h"
+#include "Parallel.h"
+#include "Pixels.h"
+
+/* Rows of the destination each job downsamples at a time */
+#define BAND_HEIGHT 16
+
+/* Rounded average of the four pixels, channel by channel */
+static uint32_t average(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+  uint32_t result = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    uint32_t sum = ((p0 >> shift) & 0xff) + ((p1 >> shift) & 0xff) +
+                   ((p2 >> shift) & 0xff) + ((p3 >> shift) & 0xff);
+    result |= ((sum + 2) >> 2) << shift;
+  }
+  return result;
+}
+
+#ifdef __SSE2__
+/*
+ * Sum the 2x2 source pixels of two destination pixels, from four pixels of
+ * row0 and of row1. The channel sums are 16 bit lanes, the first
+ * destination pixel in the low half.
+ */
+static __m128i sumPairs(__m128i row0, __m128i row1)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero),
+                              _mm_unpacklo_epi8(row1, zero));
+  __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero),
+                               _mm_unpackhi_epi8(row1, zero));
+  low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+  high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+  return _mm_unpacklo_epi64(low, high);
+}
+#endif
+
+struct DownsampleParams {
+  const uint32_t *src;
+  int srcPitch;
+  int srcWidth, srcHeight;
+  uint32_t *dst;
+  int dstPitch;
+  int dstWidth, dstHeight;
+};
+
+static void downsampleBand(int band, int worker, void *param)
+{
+  struct DownsampleParams *params = (struct DownsampleParams *)param;
+  int lastX = params->srcWidth - 1;
+  int lastY = params->srcHeight - 1;
+  int endY = band * BAND_HEIGHT + BAND_HEIGHT;
+  if (endY > params->dstHeight) {
+    endY = params->dstHeight;
+  }
+
+  for (int y = band * BAND_HEIGHT; y < endY; y++) {
+    /* A source of one row or column is averaged with itself */
+    const uint32_t *row0 = getRow(params->src, params->srcPitch, 2 * y);
+    const uint32_t *row1 = getRow(params->src, params->srcPitch,
+                                  2 * y + 1 <= lastY ? 2 * y + 1 : lastY);
+    uint32_t *dst = getRow(params->dst, params->dstPitch, y);
+    int x = 0;
+
+#ifdef __SSE2__
+    if (lastX > 0) {
+      const __m128i two = _mm_set1_epi16(2);
+      for (; x + 4 <= params->dstWidth; x += 4) {
+        __m128i a = sumPairs(
+            _mm_loadu_si128((const __m128i *)(row0 + 2 * x)),
+            _mm_loadu_si128((const __m128i *)(row1 + 2 * x)));
+        __m128i b = sumPairs(
+            _mm_loadu_si128((const __m128i *)(row0 + 2 * x + 4)),
+            _mm_loadu_si128((const __m128i *)(row1 + 2 * x + 4)));
+        a = _mm_srli_epi16(_mm_add_epi16(a, two), 2);
+        b = _mm_srli_epi16(_mm_add_epi16(b, two), 2);
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(a, b));
+      }
+    }
+#endif
+
+    for (; x < params->dstWidth; x++) {
+      int x1 = 2 * x + 1 <= lastX ? 2 * x + 1 : lastX;
+      dst[x] = average(row0[2 * x], row0[x1], row1[2 * x], row1[x1]);
+    }
+  }
+}
+
+int Mip::getNumLevels(int width, int height)
+{
+  int numLevels = 1;
+  while (width > 1 || height > 1) {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    numLevels++;
+  }
+  return numLevels;
+}
+
+void Mip::downsample(const uint32_t *src, int srcPitch, int srcWidth,
+                     int srcHeight, uint32_t *dst, int dstPitch, int jobs)
+{
+  struct DownsampleParams params;
+  params.src = src;
+  params.srcPitch = srcPitch;
+  params.srcWidth = srcWidth;
+  params.srcHeight = srcHeight;
+  params.dst = dst;
+  params.dstPitch = dstPitch;
+  params.dstWidth = srcWidth > 1 ? srcWidth / 2 : 1;
+  params.dstHeight = srcHeight > 1 ? srcHeight / 2 : 1;
+
+  Parallel::forEach((params.dstHeight + BAND_HEIGHT - 1) / BAND_HEIGHT, jobs,
+                    downsampleBand, &params);
+}
+
+void Mip::generate(const uint32_t *pixels, int pitch, int width, int height,
+                   std::vector<Level> *levels, int jobs)
+{
+  levels->resize(getNumLevels(width, height) - 1);
+
+  for (size_t i = 0; i < levels->size(); i++) {
+    Level *level = &(*levels)[i];
+    level->width = width > 1 ? width / 2 : 1;
+    level->height = height > 1 ? height / 2 : 1;
+    level->pixels.resize((size_t)level->width * level->height);
+
+    downsample(pixels, pitch, width, height, &level->pixels[0],
+               level->width * sizeof(uint32_t), jobs);
+
+    pixels = &level->pixels[0];
+    pitch = level->width * sizeof(uint32_t);
+    width = level->width;
+    height = level->height;
+  }
+}
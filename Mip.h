@@ -0,0 +1,47 @@
+#ifndef _MIP_H_
+#define _MIP_H_
+
+#include <stdint.h>
+#include <vector>
+
+class Mip {
+
+public:
+  /* One level of a mip chain, tightly packed (pitch width * 4) */
+  struct Level {
+    int width, height;
+    std::vector<uint32_t> pixels;
+  };
+
+  /*
+   * getNumLevels()
+   *
+   * Number of levels of a full mip chain of an image, the image itself
+   * included, down to 1x1.
+   */
+  static int getNumLevels(int width, int height);
+
+  /*
+   * downsample()
+   *
+   * Halve a 32 bit image with a 2x2 box filter: each channel of a
+   * destination pixel is the rounded average of four source pixels. The
+   * destination is max(1, width / 2) x max(1, height / 2), an odd last
+   * column or row of the source is left out. Pitches are in bytes. Bands
+   * of rows are shared out to jobs threads, see Parallel.
+   */
+  static void downsample(const uint32_t *src, int srcPitch, int srcWidth,
+                         int srcHeight, uint32_t *dst, int dstPitch,
+                         int jobs);
+
+  /*
+   * generate()
+   *
+   * Make the levels of a full mip chain below an image, each from the one
+   * above it: levels gets level 1 (half size) down to 1x1.
+   */
+  static void generate(const uint32_t *pixels, int pitch, int width,
+                       int height, std::vector<Level> *levels, int jobs);
+};
+
+#endif
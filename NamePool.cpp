@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Hash.h"
+#include "NamePool.h"
+
+/* Size of the blocks names are packed in, longer names get their own */
+#define BLOCK_SIZE (64 * 1024)
+
+size_t NamePool::NameHash::operator()(const Name &name) const
+{
+  return Hash::hash64(name.str, name.len);
+}
+
+bool NamePool::NameEqual::operator()(const Name &a, const Name &b) const
+{
+  return a.len == b.len && memcmp(a.str, b.str, a.len) == 0;
+}
+
+NamePool::NamePool()
+{
+  mBlockUsed = BLOCK_SIZE;
+  mNumBytes = 0;
+}
+
+NamePool::~NamePool()
+{
+  for (size_t i = 0; i < mBlocks.size(); i++) {
+    free(mBlocks[i]);
+  }
+}
+
+const char *NamePool::intern(const char *str, size_t len)
+{
+  Name name = {str, len};
+  std::unordered_set<Name, NameHash, NameEqual>::iterator it =
+      mNames.find(name);
+  if (it != mNames.end()) {
+    return it->str;
+  }
+
+  char *copy;
+  if (len + 1 > BLOCK_SIZE) {
+    /* Kept ahead of the last block so that one keeps filling up */
+    copy = (char *)malloc(len + 1);
+    mBlocks.insert(mBlocks.end() - (mBlocks.empty() ? 0 : 1), copy);
+  } else {
+    if (mBlockUsed + len + 1 > BLOCK_SIZE) {
+      mBlocks.push_back((char *)malloc(BLOCK_SIZE));
+      mBlockUsed = 0;
+    }
+    copy = mBlocks.back() + mBlockUsed;
+    mBlockUsed += len + 1;
+  }
+
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  mNumBytes += len + 1;
+  name.str = copy;
+  mNames.insert(name);
+  return copy;
+}
+
+const char *NamePool::intern(const char *str)
+{
+  return intern(str, strlen(str));
+}
@@ -0,0 +1,57 @@
+#ifndef _NAMEPOOL_H_
+#define _NAMEPOOL_H_
+
+#include <stddef.h>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * Interned strings: each distinct string is stored once, packed one after
+ * the other in large blocks rather than allocated one by one. The strings
+ * stay where they are for the life of the pool.
+ */
+class NamePool {
+
+public:
+  NamePool();
+  ~NamePool();
+
+  /*
+   * intern()
+   *
+   * Get the pooled copy of a string of len chars (it need not be
+   * terminated), adding it if it is not in the pool yet. The copy is
+   * terminated.
+   */
+  const char *intern(const char *str, size_t len);
+  const char *intern(const char *str);
+
+  /* Distinct strings, and bytes taken by them in the blocks */
+  size_t getNumNames() { return mNames.size(); }
+  size_t getNumBytes() { return mNumBytes; }
+
+private:
+  struct Name {
+    const char *str;
+    size_t len;
+  };
+
+  struct NameHash {
+    size_t operator()(const Name &name) const;
+  };
+
+  struct NameEqual {
+    bool operator()(const Name &a, const Name &b) const;
+  };
+
+  /* Not copyable, the names point into the blocks */
+  NamePool(const NamePool &);
+  NamePool &operator=(const NamePool &);
+
+  std::vector<char *> mBlocks;
+  size_t mBlockUsed; /* Bytes taken in the last block */
+  size_t mNumBytes;
+  std::unordered_set<Name, NameHash, NameEqual> mNames;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Packer.h"
+
+using namespace Atlas;
+
+static const struct {
+  PackerType type;
+  const char *name;
+} packerTypes[] = {
+    {PackerGuillotine, "guillotine"},
+    {PackerMaxRectsBssf, "maxrects-bssf"},
+    {PackerMaxRectsBaf, "maxrects-baf"},
+    {PackerSkyline, "skyline"},
+};
+
+#define NUM_PACKER_TYPES (sizeof(packerTypes) / sizeof(packerTypes[0]))
+
+Packer *Packer::create(PackerType type)
+{
+  switch (type) {
+  case PackerGuillotine:
+    return new GuillotinePacker();
+  case PackerMaxRectsBssf:
+    return new MaxRectsPacker(MaxRectsPacker::BestShortSideFit);
+  case PackerMaxRectsBaf:
+    return new MaxRectsPacker(MaxRectsPacker::BestAreaFit);
+  case PackerSkyline:
+    return new SkylinePacker();
+  }
+  return NULL;
+}
+
+const char *Packer::getTypeName(PackerType type)
+{
+  for (unsigned int i = 0; i < NUM_PACKER_TYPES; i++) {
+    if (packerTypes[i].type == type) {
+      return packerTypes[i].name;
+    }
+  }
+  return NULL;
+}
+
+int Packer::getTypeByName(const char *name)
+{
+  for (unsigned int i = 0; i < NUM_PACKER_TYPES; i++) {
+    if (strcmp(packerTypes[i].name, name) == 0) {
+      return packerTypes[i].type;
+    }
+  }
+  return -1;
+}
+
+void Packer::getUsedArea(int *width, int *height)
+{
+  std::vector<Placement> placements;
+  getPlacements(&placements);
+
+  *width = 0;
+  *height = 0;
+  for (size_t i = 0; i < placements.size(); i++) {
+    Placement *placement = &placements[i];
+    if (placement->left + placement->width > *width) {
+      *width = placement->left + placement->width;
+    }
+    if (placement->top + placement->height > *height) {
+      *height = placement->top + placement->height;
+    }
+  }
+}
+
+/*
+ * Guillotine packer, the Atlas::Node tree
+ */
+
+void GuillotinePacker::reset(int width, int height, int numRects)
+{
+  mWidth = width;
+  mHeight = height;
+  mPool.setSplitRule(mSplitRule);
+  mPool.reset(width, height, numRects);
+}
+
+bool GuillotinePacker::insert(NodeRect *rect)
+{
+  return mPool.getRoot()->insert(rect, mAllowRotate) != NULL;
+}
+
+static void addPlacement(int level, Node *node, void *param)
+{
+  std::vector<Placement> *placements = (std::vector<Placement> *)param;
+  Placement placement;
+  placement.rect = node->getRect();
+  placement.left = node->getLeft();
+  placement.top = node->getTop();
+  placement.width = node->getWidth();
+  placement.height = node->getHeight();
+  placement.rotated = node->isRotated();
+  placements->push_back(placement);
+}
+
+void GuillotinePacker::getPlacements(std::vector<Placement> *placements)
+{
+  placements->clear();
+  mPool.getRoot()->poTraversal(0, addPlacement, placements);
+}
@@ -0,0 +1,171 @@
+#ifndef _PACKER_H_
+#define _PACKER_H_
+
+#include <vector>
+
+#include "Atlas.h"
+
+namespace Atlas {
+
+/*
+ * Where a rectangle ended up in the atlas
+ */
+struct Placement {
+  NodeRect *rect;
+  int left, top, width, height;
+
+  /*
+   * Rect is stored turned 90 degrees clockwise, width and height are
+   * then the rect's height and width.
+   */
+  bool rotated;
+};
+
+enum PackerType {
+  PackerGuillotine,   /* Node tree, split by SplitRule (larger leftover
+                         by default) */
+  PackerMaxRectsBssf, /* MaxRects, best short side fit */
+  PackerMaxRectsBaf,  /* MaxRects, best area fit */
+  PackerSkyline,      /* Skyline, bottom left */
+};
+
+/*
+ * Interface of the rectangle packing engines
+ */
+class Packer {
+
+public:
+  Packer()
+  {
+    mWidth = 0;
+    mHeight = 0;
+    mAllowRotate = false;
+    mSplitRule = SplitLargerLeftover;
+  }
+  virtual ~Packer() {}
+
+  /*
+   * Let the packer turn rectangles 90 degrees when that fits better.
+   */
+  void setAllowRotate(bool allowRotate) { mAllowRotate = allowRotate; }
+
+  /*
+   * How free space is cut after a placement. Only the guillotine packer
+   * has a choice, the others ignore it.
+   */
+  void setSplitRule(SplitRule splitRule) { mSplitRule = splitRule; }
+
+  /*
+   * Start over with an empty area of the given size. numRects is a hint
+   * of how many rectangles will be inserted.
+   */
+  virtual void reset(int width, int height, int numRects) = 0;
+
+  /*
+   * Place a rectangle. Returns false if there is no room left for it.
+   */
+  virtual bool insert(NodeRect *rect) = 0;
+
+  /*
+   * Get the placement of every rectangle inserted since the last reset.
+   */
+  virtual void getPlacements(std::vector<Placement> *placements) = 0;
+
+  /*
+   * Number of nodes the packer holds for what was inserted since the last
+   * reset: tree nodes, free rectangles or skyline segments.
+   */
+  virtual int getNumNodes() = 0;
+
+  /*
+   * Get the size of the bounding box of all placements.
+   */
+  void getUsedArea(int *width, int *height);
+
+  int getWidth() { return mWidth; }
+  int getHeight() { return mHeight; }
+
+  /*
+   * Create a packer of the given type, NULL if the type is unknown.
+   */
+  static Packer *create(PackerType type);
+
+  /*
+   * Command line name of a packer type, and the reverse.
+   * Returns NULL / -1 if not known.
+   */
+  static const char *getTypeName(PackerType type);
+  static int getTypeByName(const char *name);
+
+protected:
+  int mWidth, mHeight;
+  bool mAllowRotate;
+  SplitRule mSplitRule;
+};
+
+class GuillotinePacker : public Packer {
+
+public:
+  void reset(int width, int height, int numRects);
+  bool insert(NodeRect *rect);
+  void getPlacements(std::vector<Placement> *placements);
+  int getNumNodes() { return mPool.getNumNodes(); }
+  Node *getRoot() { return mPool.getRoot(); }
+
+private:
+  NodePool mPool;
+};
+
+class MaxRectsPacker : public Packer {
+
+public:
+  enum Heuristic {
+    BestShortSideFit,
+    BestAreaFit,
+  };
+
+  MaxRectsPacker(Heuristic heuristic) { mHeuristic = heuristic; }
+  void reset(int width, int height, int numRects);
+  bool insert(NodeRect *rect);
+  void getPlacements(std::vector<Placement> *placements);
+  int getNumNodes() { return mFreeRects.size(); }
+
+private:
+  struct Rect {
+    int left, top, width, height;
+  };
+
+  bool findPosition(int w, int h, int *bestIndex, int *bestScore1,
+                    int *bestScore2);
+  bool splitFreeRect(const Rect &freeRect, const Rect &usedRect);
+  void pruneFreeList();
+
+  Heuristic mHeuristic;
+  std::vector<Rect> mFreeRects;
+  std::vector<Rect> mNewFreeRects;
+  std::vector<Placement> mPlacements;
+};
+
+class SkylinePacker : public Packer {
+
+public:
+  void reset(int width, int height, int numRects);
+  bool insert(NodeRect *rect);
+  void getPlacements(std::vector<Placement> *placements);
+  int getNumNodes() { return mSkyline.size(); }
+
+private:
+  struct Segment {
+    int left, top, width;
+  };
+
+  int fitsAt(int index, int w, int h);
+  bool findPosition(int w, int h, int *bestIndex, int *bestTop,
+                    int *bestBottom, int *bestWidth);
+  void addLevel(int index, int left, int top, int w, int h);
+
+  std::vector<Segment> mSkyline;
+  std::vector<Placement> mPlacements;
+};
+} // namespace Atlas
+#endif
@@ -0,0 +1,53 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "Parallel.h"
+
+int Parallel::getNumWorkers(int count, int jobs)
+{
+  if (jobs <= 0) {
+    jobs = std::thread::hardware_concurrency();
+    if (jobs <= 0) {
+      jobs = 1;
+    }
+  }
+  if (jobs > count) {
+    jobs = count;
+  }
+  return jobs > 0 ? jobs : 1;
+}
+
+static void workerLoop(std::atomic<int> *next, int count, int worker,
+                       void (*callback)(int, int, void *), void *param)
+{
+  int index;
+  while ((index = next->fetch_add(1)) < count) {
+    callback(index, worker, param);
+  }
+}
+
+void Parallel::forEach(int count, int jobs,
+                       void (*callback)(int index, int worker, void *param),
+                       void *param)
+{
+  int numWorkers = getNumWorkers(count, jobs);
+  std::atomic<int> next(0);
+
+  if (numWorkers <= 1) {
+    workerLoop(&next, count, 0, callback, param);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < numWorkers; i++) {
+    threads.push_back(std::thread(workerLoop, &next, count, i, callback, param));
+  }
+
+  /* The calling thread takes part as worker 0 */
+  workerLoop(&next, count, 0, callback, param);
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+namespace Parallel {
+
+/*
+ * getNumWorkers()
+ *
+ * Number of worker threads forEach() will use for the given amount of
+ * work items and requested jobs. A job count <= 0 means one worker per
+ * hardware thread.
+ */
+int getNumWorkers(int count, int jobs);
+
+/*
+ * forEach()
+ *
+ * Call callback(index, worker, param) once for every index in [0, count).
+ * Indexes are handed out to the workers through a shared atomic counter,
+ * so the call order is not defined but each worker number is only used by
+ * one thread at a time. Runs on the calling thread when only one worker is
+ * needed. Returns when all indexes have been processed.
+ */
+void forEach(int count, int jobs,
+             void (*callback)(int index, int worker, void *param),
+             void *param);
+} // namespace Parallel
+#endif
@@ -0,0 +1,20 @@
+#ifndef _PIXELS_H_
+#define _PIXELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Row y of an image of 32 bit pixels, pitch is in bytes
+ */
+static inline const uint32_t *getRow(const uint32_t *pixels, int pitch, int y)
+{
+  return (const uint32_t *)((const uint8_t *)pixels + (size_t)y * pitch);
+}
+
+static inline uint32_t *getRow(uint32_t *pixels, int pitch, int y)
+{
+  return (uint32_t *)((uint8_t *)pixels + (size_t)y * pitch);
+}
+
+#endif
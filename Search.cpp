@@ -0,0 +1,761 @@
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "Parallel.h"
+#include "Search.h"
+
+using namespace Atlas;
+
+class Dimension {
+public:
+  Dimension(int w, int h)
+  {
+    mWidth = w;
+    mHeight = h;
+  }
+
+  int mWidth, mHeight;
+};
+
+bool Search::tryCreate(int w, int h, std::vector<NodeRect *> &rectList,
+                       Packer *packer, NodeRect **failedRect, int *failedAt)
+{
+  std::vector<NodeRect *>::iterator it;
+  packer->reset(w, h, rectList.size());
+
+  int i = 0;
+  for (it = rectList.begin(); it != rectList.end(); it++) {
+    NodeRect *rect = *it;
+    i++;
+    if (!packer->insert(rect)) {
+      *failedRect = rect;
+      *failedAt = i;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+enum CandidateState {
+  CandidateNotTried,
+  CandidateFailed,
+  CandidateFitted,
+};
+
+/*
+ * State of one search worker. The worker builds its attempts in one packer
+ * and keeps the best packing it has found so far in the other, the two swap
+ * roles whenever a new best is found.
+ */
+struct SearchWorker {
+  Packer *attemptPacker;
+  Packer *bestPacker;
+  int bestIndex;
+};
+
+struct SearchParams {
+  Search::Strategy strategy;
+  std::vector<Dimension *> candidates;
+  std::vector<Dimension> fittedSize;
+  std::vector<char> state;
+  std::vector<NodeRect *> failedRect;
+  std::vector<int> failedAt;
+
+  /* StrategyPruned: lowest candidate index known to fit */
+  std::atomic<int> firstFit;
+
+  /* StrategyBisect: candidate indexes per width, by increasing height */
+  std::vector<std::vector<int> > groups;
+
+  /*
+   * Non power of two sizes: every candidate is a width with the maximum
+   * height, fitted sizes get the height cropped to what was used
+   * (rounded up to align). bestArea is the smallest fitted area so far.
+   */
+  bool npot;
+  int align;
+  int minHeight;
+  std::atomic<unsigned long long> bestArea;
+
+  std::vector<NodeRect *> *rectList;
+  unsigned long long numPixels;
+  std::vector<SearchWorker> workers;
+
+  /* Statistics over all attempts */
+  std::atomic<int> numAttempts;
+  std::atomic<unsigned long long> numNodesCreated;
+};
+
+double Search::getTimeMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static unsigned long long getWaste(Dimension *dim, unsigned long long numPixels)
+{
+  return (unsigned long long)dim->mWidth * dim->mHeight - numPixels;
+}
+
+static double getRatio(Dimension *dim)
+{
+  if (dim->mHeight < dim->mWidth)
+    return (double)dim->mHeight / (double)dim->mWidth;
+  else
+    return (double)dim->mWidth / (double)dim->mHeight;
+}
+
+static int roundUp(int value, int align)
+{
+  return (value + align - 1) / align * align;
+}
+
+/*
+ * Compare two fitted candidates: less waste wins, then the ratio closest
+ * to 1.0 and last the one first in the candidate list. This gives the same
+ * choice as trying the candidates one by one, in any order.
+ */
+static bool isBetterFit(SearchParams *params, int index, int bestIndex)
+{
+  if (bestIndex < 0) {
+    return true;
+  }
+
+  Dimension *dim = &params->fittedSize[index];
+  Dimension *best = &params->fittedSize[bestIndex];
+  unsigned long long waste = getWaste(dim, params->numPixels);
+  unsigned long long bestWaste = getWaste(best, params->numPixels);
+
+  if (waste != bestWaste) {
+    return waste < bestWaste;
+  }
+  if (getRatio(dim) != getRatio(best)) {
+    return getRatio(dim) > getRatio(best);
+  }
+  return index < bestIndex;
+}
+
+/* Used when sorting candidates from best to worst possible fit */
+struct CandidateOrder {
+  SearchParams *params;
+  bool operator()(Dimension *dim1, Dimension *dim2) const
+  {
+    unsigned long long waste1 = getWaste(dim1, params->numPixels);
+    unsigned long long waste2 = getWaste(dim2, params->numPixels);
+    if (waste1 != waste2) {
+      return waste1 < waste2;
+    }
+    return getRatio(dim1) > getRatio(dim2);
+  }
+};
+
+/*
+ * Try one candidate on the given worker, keeping the tree if it is the
+ * best the worker has seen. Returns true if all images fitted.
+ */
+static bool tryCandidate(SearchParams *params, int worker, int index)
+{
+  SearchWorker *sw = &params->workers[worker];
+  Dimension *dim = params->candidates[index];
+
+  bool fitted = Search::tryCreate(dim->mWidth, dim->mHeight, *params->rectList,
+                                  sw->attemptPacker, &params->failedRect[index],
+                                  &params->failedAt[index]);
+  params->numAttempts++;
+  params->numNodesCreated += sw->attemptPacker->getNumNodes();
+  if (!fitted) {
+    params->state[index] = CandidateFailed;
+    return false;
+  }
+
+  params->state[index] = CandidateFitted;
+
+  if (params->npot) {
+    int usedWidth, usedHeight;
+    sw->attemptPacker->getUsedArea(&usedWidth, &usedHeight);
+    Dimension *size = &params->fittedSize[index];
+    size->mHeight = roundUp(std::max(usedHeight, 1), params->align);
+
+    unsigned long long area = (unsigned long long)size->mWidth * size->mHeight;
+    unsigned long long bestArea = params->bestArea.load();
+    while (area < bestArea &&
+           !params->bestArea.compare_exchange_weak(bestArea, area)) {
+    }
+  }
+
+  if (isBetterFit(params, index, sw->bestIndex)) {
+    Packer *tmpPacker = sw->bestPacker;
+    sw->bestPacker = sw->attemptPacker;
+    sw->attemptPacker = tmpPacker;
+    sw->bestIndex = index;
+  }
+  return true;
+}
+
+static void searchCandidate(int index, int worker, void *param)
+{
+  SearchParams *params = (SearchParams *)param;
+
+  if (params->npot) {
+
+    /*
+     * A width can not beat the best fit so far if even a perfectly dense
+     * packing (no lower than the highest image) would take more area.
+     */
+
+    if (params->strategy != Search::StrategyExhaustive) {
+      unsigned long long width = params->candidates[index]->mWidth;
+      int minHeight = std::max((unsigned long long)params->minHeight,
+                               (params->numPixels + width - 1) / width);
+      if (width * roundUp(minHeight, params->align) >
+          params->bestArea.load()) {
+        return;
+      }
+    }
+    tryCandidate(params, worker, index);
+  } else if (params->strategy == Search::StrategyPruned) {
+
+    /*
+     * Candidates are sorted from best to worst, nothing after a fitted
+     * candidate can win. Everything before it is still tried, so the
+     * first fit found is the same whatever the scheduling.
+     */
+
+    if (index > params->firstFit.load()) {
+      return;
+    }
+    if (tryCandidate(params, worker, index)) {
+      int firstFit = params->firstFit.load();
+      while (index < firstFit &&
+             !params->firstFit.compare_exchange_weak(firstFit, index)) {
+      }
+    }
+  } else {
+    tryCandidate(params, worker, index);
+  }
+}
+
+static void searchGroup(int group, int worker, void *param)
+{
+  SearchParams *params = (SearchParams *)param;
+  std::vector<int> &heights = params->groups[group];
+
+  /*
+   * Assume that if a height fits then all larger heights do too and
+   * binary search for the smallest one that fits.
+   */
+
+  int low = 0;
+  int high = heights.size() - 1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    if (tryCandidate(params, worker, heights[mid])) {
+      high = mid - 1;
+    } else {
+      low = mid + 1;
+    }
+  }
+}
+
+bool Search::findBestFit(std::vector<NodeRect *> &rectList, Options *options,
+                         Result *result)
+{
+  std::vector<NodeRect *>::iterator it;
+  std::list<Dimension *> resolutionList;
+  std::list<Dimension *>::iterator rit;
+
+  /*
+   * Generate surface resolutions
+   */
+
+  if (options->npot) {
+    /* Any multiple of align wide, cropped to the height used */
+    for (int w = options->align; w <= options->maxSize; w += options->align) {
+      resolutionList.push_back(new Dimension(w, options->maxSize));
+    }
+  } else {
+    for (int h = 32; h <= options->maxSize; h *= 2) {
+      for (int w = 32; w <= options->maxSize; w *= 2) {
+        resolutionList.push_back(new Dimension(w, h));
+      }
+    }
+  }
+
+  /*
+   * Sum the total number of pixels
+   */
+
+  unsigned long long numPixels = 0;
+  int maxWidth = 0;
+  int maxHeight = 0;
+  int maxLongSide = 0;
+  for (it = rectList.begin(); it != rectList.end(); it++) {
+    NodeRect *rect = *it;
+    numPixels += rect->getWidth() * rect->getHeight();
+    if (options->allowRotate) {
+      /* Every image needs its short side to fit both ways */
+      int shortSide = std::min(rect->getWidth(), rect->getHeight());
+      maxWidth = std::max(maxWidth, shortSide);
+      maxHeight = std::max(maxHeight, shortSide);
+      maxLongSide = std::max(
+          maxLongSide, std::max(rect->getWidth(), rect->getHeight()));
+    } else {
+      maxWidth = std::max(maxWidth, rect->getWidth());
+      maxHeight = std::max(maxHeight, rect->getHeight());
+    }
+  }
+
+  /*
+   * Try to fit all images in the list surfaces with different
+   * resolutions, then choose to use the tree with the least waste
+   * of unused pixels.
+   *
+   * If there are more than one surface with the same amount of waste
+   * we use the one with its height/width ratio closest to 1.0.
+   *
+   * The resolutions are tried in parallel, each worker keeping the
+   * best tree it found. The results are then walked in list order so
+   * the choice (and the report) does not depend on the scheduling.
+   */
+
+  SearchParams searchParams;
+  searchParams.strategy = options->strategy;
+  searchParams.rectList = &rectList;
+  searchParams.numPixels = numPixels;
+  searchParams.firstFit = resolutionList.size();
+  searchParams.npot = options->npot;
+  searchParams.align = options->align;
+  searchParams.minHeight = maxHeight;
+  searchParams.bestArea = (unsigned long long)-1;
+  searchParams.numAttempts = 0;
+  searchParams.numNodesCreated = 0;
+
+  for (rit = resolutionList.begin(); rit != resolutionList.end(); rit++) {
+    Dimension *dim = *rit;
+
+    /*
+     * Unless asked to try everything, drop the resolutions that are
+     * too small or too narrow/low for the largest image to ever fit.
+     */
+
+    if (options->strategy != Search::StrategyExhaustive &&
+        (dim->mWidth < maxWidth || dim->mHeight < maxHeight ||
+         std::max(dim->mWidth, dim->mHeight) < maxLongSide ||
+         (unsigned long long)dim->mWidth * dim->mHeight < numPixels)) {
+      continue;
+    }
+    searchParams.candidates.push_back(dim);
+  }
+
+  if (options->strategy == Search::StrategyPruned && !options->npot) {
+    CandidateOrder order = {&searchParams};
+    std::stable_sort(searchParams.candidates.begin(),
+                     searchParams.candidates.end(), order);
+  }
+
+  int numCandidates = searchParams.candidates.size();
+  for (int i = 0; i < numCandidates; i++) {
+    searchParams.fittedSize.push_back(*searchParams.candidates[i]);
+  }
+  searchParams.state.assign(numCandidates, CandidateNotTried);
+  searchParams.failedRect.assign(numCandidates, NULL);
+  searchParams.failedAt.assign(numCandidates, 0);
+
+  int numTasks = numCandidates;
+  void (*searchTask)(int, int, void *) = searchCandidate;
+  if (options->strategy == Search::StrategyBisect && !options->npot) {
+    for (int i = 0; i < numCandidates; i++) {
+      Dimension *dim = searchParams.candidates[i];
+      size_t g = 0;
+      while (g < searchParams.groups.size() &&
+             searchParams.candidates[searchParams.groups[g][0]]->mWidth !=
+                 dim->mWidth) {
+        g++;
+      }
+      if (g == searchParams.groups.size()) {
+        searchParams.groups.push_back(std::vector<int>());
+      }
+      searchParams.groups[g].push_back(i);
+    }
+    numTasks = searchParams.groups.size();
+    searchTask = searchGroup;
+  }
+
+  searchParams.workers.resize(Parallel::getNumWorkers(numTasks, options->jobs));
+  for (size_t i = 0; i < searchParams.workers.size(); i++) {
+    SearchWorker *sw = &searchParams.workers[i];
+    sw->attemptPacker = Packer::create(options->packer);
+    sw->bestPacker = Packer::create(options->packer);
+    sw->attemptPacker->setAllowRotate(options->allowRotate);
+    sw->bestPacker->setAllowRotate(options->allowRotate);
+    sw->attemptPacker->setSplitRule(options->splitRule);
+    sw->bestPacker->setSplitRule(options->splitRule);
+    sw->bestIndex = -1;
+  }
+
+  double startTime = Search::getTimeMs();
+  Parallel::forEach(numTasks, options->jobs, searchTask, &searchParams);
+  double packTime = Search::getTimeMs() - startTime;
+
+  int lastCandidate = numCandidates - 1;
+  if (options->strategy == Search::StrategyPruned && !options->npot) {
+    lastCandidate = std::min(lastCandidate, searchParams.firstFit.load());
+  }
+
+  /*
+   * Report the results. In non power of two mode there can be thousands
+   * of candidates, and which of them get skipped depends on the
+   * scheduling, so only the chosen size is reported there.
+   */
+
+  int bestIndex = -1;
+  int numTried = 0;
+  for (int i = 0; i <= lastCandidate; i++) {
+    Dimension *dim = &searchParams.fittedSize[i];
+
+    if (searchParams.state[i] == CandidateFailed) {
+      NodeRect *rect = searchParams.failedRect[i];
+      if (options->verbose && !options->npot) {
+        printf("Failed to insert image %d (w: %d, h: %d) in "
+               "surface (dimension w: %d, h: %d)\n",
+               searchParams.failedAt[i], rect->getWidth(),
+               rect->getHeight(), dim->mWidth, dim->mHeight);
+      }
+      numTried++;
+    } else if (searchParams.state[i] == CandidateFitted) {
+
+      /* Got a tree, compare it to the best so far */
+
+      if (options->verbose && !options->npot) {
+        printf("Surface with dimension %d x %d created (ratio: %f, "
+               "waste: %llu pixels)\n",
+               dim->mWidth, dim->mHeight, getRatio(dim),
+               getWaste(dim, numPixels));
+      }
+
+      if (isBetterFit(&searchParams, i, bestIndex)) {
+        if (options->verbose && !options->npot) {
+          printf("Surface with dimension %d x %d best so far\n",
+                 dim->mWidth, dim->mHeight);
+        }
+        bestIndex = i;
+      }
+      numTried++;
+    }
+  }
+
+  if (options->verbose) {
+    printf("Tried %d of %d surface dimensions\n", numTried,
+           (int)resolutionList.size());
+  }
+
+  Dimension *bestDimension = NULL;
+  for (size_t i = 0; i < searchParams.workers.size(); i++) {
+    SearchWorker *sw = &searchParams.workers[i];
+    if (bestIndex >= 0 && sw->bestIndex == bestIndex) {
+      sw->bestPacker->getPlacements(&result->placements);
+      result->numNodes = sw->bestPacker->getNumNodes();
+      bestDimension = &searchParams.fittedSize[bestIndex];
+
+      if (options->npot) {
+        /* Crop the surface to the area used */
+        int usedWidth, usedHeight;
+        sw->bestPacker->getUsedArea(&usedWidth, &usedHeight);
+        bestDimension->mWidth = roundUp(usedWidth, options->align);
+        bestDimension->mHeight = roundUp(usedHeight, options->align);
+      }
+    }
+    delete sw->attemptPacker;
+    delete sw->bestPacker;
+  }
+
+  result->numDimensions = resolutionList.size();
+  result->numTried = numTried;
+  result->numPixels = numPixels;
+  result->packTime = packTime;
+  result->numAttempts = searchParams.numAttempts.load();
+  result->numNodesCreated = searchParams.numNodesCreated.load();
+
+  if (options->verbose && bestDimension) {
+    unsigned long long area =
+        (unsigned long long)bestDimension->mWidth * bestDimension->mHeight;
+    printf("Packed %d images with the %s packer in %.1f ms "
+           "(%d x %d, waste: %llu pixels, occupancy: %.1f%%)\n",
+           (int)rectList.size(), Packer::getTypeName(options->packer),
+           packTime,
+           bestDimension->mWidth, bestDimension->mHeight,
+           getWaste(bestDimension, numPixels),
+           100.0 * (double)numPixels / (double)area);
+  }
+
+  for (rit = resolutionList.begin(); rit != resolutionList.end(); rit++) {
+    delete *rit;
+  }
+
+  if (!bestDimension) {
+    return false;
+  }
+
+  result->width = bestDimension->mWidth;
+  result->height = bestDimension->mHeight;
+  return true;
+}
+
+static const char *orderNames[] = {
+    "width", "height", "area", "max-side", "perimeter",
+};
+
+#define NUM_ORDERS (sizeof(orderNames) / sizeof(orderNames[0]))
+
+const char *Search::getOrderName(Order order)
+{
+  return (unsigned int)order < NUM_ORDERS ? orderNames[order] : NULL;
+}
+
+int Search::getOrderByName(const char *name)
+{
+  for (unsigned int i = 0; i < NUM_ORDERS; i++) {
+    if (strcmp(orderNames[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* Used when sorting rectangles from largest to smallest */
+struct RectOrder {
+  Search::Order order;
+
+  /* Sort keys of a rectangle, the most significant first */
+  void getKeys(NodeRect *rect, long long keys[3]) const
+  {
+    long long w = rect->getWidth();
+    long long h = rect->getHeight();
+    keys[0] = w;
+    keys[1] = w;
+    keys[2] = h;
+
+    switch (order) {
+    case Search::OrderWidth:
+      break;
+    case Search::OrderHeight:
+      keys[0] = h;
+      break;
+    case Search::OrderArea:
+      keys[0] = w * h;
+      break;
+    case Search::OrderMaxSide:
+      keys[0] = std::max(w, h);
+      keys[1] = std::min(w, h);
+      break;
+    case Search::OrderPerimeter:
+      keys[0] = w + h;
+      break;
+    }
+  }
+
+  bool operator()(NodeRect *rect1, NodeRect *rect2) const
+  {
+    long long keys1[3], keys2[3];
+    getKeys(rect1, keys1);
+    getKeys(rect2, keys2);
+    for (int i = 0; i < 3; i++) {
+      if (keys1[i] != keys2[i]) {
+        return keys1[i] > keys2[i];
+      }
+    }
+    return false;
+  }
+};
+
+void Search::sortRects(std::vector<NodeRect *> &rectList, Order order)
+{
+  RectOrder rectOrder = {order};
+  std::stable_sort(rectList.begin(), rectList.end(), rectOrder);
+}
+
+struct Heuristic {
+  Search::Order order;
+  SplitRule splitRule;
+};
+
+static void getHeuristicName(Heuristic *heuristic, bool guillotine,
+                             char *name, size_t size)
+{
+  snprintf(name, size, "%s order%s",
+           Search::getOrderName(heuristic->order),
+           !guillotine ? ""
+           : heuristic->splitRule == SplitLargerLeftover
+               ? ", larger leftover split"
+               : ", smaller leftover split");
+}
+
+/*
+ * Compare the packings of two heuristics, both of all rectangles: the
+ * smaller area wins, then the ratio closest to 1.0
+ */
+static bool isBetterResult(Search::Result *result, Search::Result *best)
+{
+  Dimension dim(result->width, result->height);
+  Dimension bestDim(best->width, best->height);
+  unsigned long long area = (unsigned long long)dim.mWidth * dim.mHeight;
+  unsigned long long bestArea =
+      (unsigned long long)bestDim.mWidth * bestDim.mHeight;
+
+  if (area != bestArea) {
+    return area < bestArea;
+  }
+  return getRatio(&dim) > getRatio(&bestDim);
+}
+
+bool Search::findBestHeuristic(std::vector<NodeRect *> &rectList,
+                               Options *options, Result *result)
+{
+  if (options->timeBudget <= 0) {
+    return findBestFit(rectList, options, result);
+  }
+
+  /*
+   * Every order, each with the split rule asked for and then the other
+   * one. Only the guillotine packer splits, the others try orders only.
+   */
+
+  bool guillotine = options->packer == PackerGuillotine;
+  SplitRule splitRules[2] = {options->splitRule,
+                             options->splitRule == SplitLargerLeftover
+                                 ? SplitSmallerLeftover
+                                 : SplitLargerLeftover};
+  std::vector<Heuristic> heuristics;
+  for (unsigned int i = 0; i < NUM_ORDERS; i++) {
+    for (int j = 0; j < (guillotine ? 2 : 1); j++) {
+      Heuristic heuristic = {(Order)i, splitRules[j]};
+      heuristics.push_back(heuristic);
+    }
+  }
+
+  /*
+   * Each heuristic is a full search over the dimensions, spread over the
+   * jobs like any other. The next one is only started if it can be
+   * expected to end within the budget, going by the time taken so far.
+   * The heuristics tried, and so the result, depend on how fast the
+   * machine is at the time.
+   */
+
+  Options heuristicOptions = *options;
+  heuristicOptions.verbose = false;
+  std::vector<NodeRect *> sortedList;
+  Result attempt;
+  char name[64];
+  int bestHeuristic = -1;
+  int numHeuristics = 0;
+  int numAttempts = 0;
+  unsigned long long numNodesCreated = 0;
+
+  double startTime = getTimeMs();
+  for (size_t i = 0; i < heuristics.size(); i++) {
+    double elapsed = getTimeMs() - startTime;
+    if (i > 0 && elapsed + elapsed / i > options->timeBudget) {
+      break;
+    }
+
+    sortedList.assign(rectList.begin(), rectList.end());
+    sortRects(sortedList, heuristics[i].order);
+    heuristicOptions.splitRule = heuristics[i].splitRule;
+    bool fitted = findBestFit(sortedList, &heuristicOptions, &attempt);
+    numHeuristics++;
+    numAttempts += attempt.numAttempts;
+    numNodesCreated += attempt.numNodesCreated;
+
+    if (options->verbose) {
+      getHeuristicName(&heuristics[i], guillotine, name, sizeof(name));
+      if (fitted) {
+        printf("Packed with %s: %d x %d (waste: %llu pixels)\n", name,
+               attempt.width, attempt.height,
+               (unsigned long long)attempt.width * attempt.height -
+                   attempt.numPixels);
+      } else {
+        printf("Failed to pack with %s\n", name);
+      }
+    }
+
+    if (fitted &&
+        (bestHeuristic < 0 || isBetterResult(&attempt, result))) {
+      std::swap(*result, attempt);
+      bestHeuristic = i;
+    }
+  }
+  double packTime = getTimeMs() - startTime;
+
+  if (bestHeuristic < 0) {
+    std::swap(*result, attempt);
+  }
+  result->packTime = packTime;
+  result->numAttempts = numAttempts;
+  result->numNodesCreated = numNodesCreated;
+
+  if (options->verbose && bestHeuristic >= 0) {
+    getHeuristicName(&heuristics[bestHeuristic], guillotine, name,
+                     sizeof(name));
+    unsigned long long area =
+        (unsigned long long)result->width * result->height;
+    printf("Packed %d images with the %s packer in %.1f ms "
+           "(%d x %d, waste: %llu pixels, occupancy: %.1f%%)\n",
+           (int)rectList.size(), Packer::getTypeName(options->packer),
+           packTime, result->width, result->height,
+           area - result->numPixels,
+           100.0 * (double)result->numPixels / (double)area);
+    printf("Kept %s, best of %d of %d heuristics\n", name, numHeuristics,
+           (int)heuristics.size());
+  }
+
+  return bestHeuristic >= 0;
+}
+
+void Search::fillPage(std::vector<NodeRect *> &rectList,
+                      std::vector<NodeRect *> *spillList, Options *options,
+                      Result *result)
+{
+  std::vector<NodeRect *>::iterator it;
+  Packer *packer = Packer::create(options->packer);
+  packer->setAllowRotate(options->allowRotate);
+  packer->setSplitRule(options->splitRule);
+
+  double startTime = getTimeMs();
+  packer->reset(options->maxSize, options->maxSize, rectList.size());
+
+  result->numPixels = 0;
+  for (it = rectList.begin(); it != rectList.end(); it++) {
+    if (!packer->insert(*it)) {
+      spillList->push_back(*it);
+    } else {
+      result->numPixels +=
+          (unsigned long long)(*it)->getWidth() * (*it)->getHeight();
+    }
+  }
+  result->packTime = getTimeMs() - startTime;
+  result->numDimensions = 1;
+  result->numTried = 1;
+
+  packer->getPlacements(&result->placements);
+  result->numNodes = packer->getNumNodes();
+  result->numAttempts = 1;
+  result->numNodesCreated = result->numNodes;
+  result->width = options->maxSize;
+  result->height = options->maxSize;
+
+  if (options->npot) {
+    /* Crop the surface to the area used */
+    int usedWidth, usedHeight;
+    packer->getUsedArea(&usedWidth, &usedHeight);
+    result->width = roundUp(usedWidth, options->align);
+    result->height = roundUp(usedHeight, options->align);
+  }
+
+  delete packer;
+}
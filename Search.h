@@ -0,0 +1,160 @@
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include <vector>
+
+#include "Atlas.h"
+#include "Packer.h"
+
+/*
+ * Search for the atlas size that packs a list of rectangles best
+ */
+class Search {
+
+public:
+  enum Strategy {
+    /* Try every candidate */
+    StrategyExhaustive,
+
+    /* Skip candidates that can never fit, stop at first fit */
+    StrategyPruned,
+
+    /* Binary search the height for each width */
+    StrategyBisect,
+  };
+
+  /* Orders to sort the rectangles in before packing, largest first */
+  enum Order {
+    OrderWidth,     /* Width, then height */
+    OrderHeight,    /* Height, then width */
+    OrderArea,      /* Area, then width */
+    OrderMaxSide,   /* Longer side, then shorter side */
+    OrderPerimeter, /* Width plus height, then width */
+  };
+
+  struct Options {
+    Strategy strategy;
+    Atlas::PackerType packer;
+    Atlas::SplitRule splitRule;
+    bool allowRotate;
+    bool npot;    /* Any multiple of align instead of powers of two */
+    int align;
+    int maxSize;  /* Largest width and height to try */
+    int jobs;     /* Threads to try candidates on, <= 0 for all */
+    bool verbose; /* Print the candidates tried and the result */
+
+    /*
+     * findBestHeuristic(): milliseconds to spend trying other orders and
+     * split rules, 0 to only pack the list as given
+     */
+    int timeBudget;
+  };
+
+  struct Result {
+    int width, height;
+    std::vector<Atlas::Placement> placements;
+
+    /* Candidate sizes generated and tried (fitted or failed) */
+    int numDimensions;
+    int numTried;
+
+    /* Area of all rectangles, nodes held by the chosen packing */
+    unsigned long long numPixels;
+    int numNodes;
+
+    /* tryCreate() calls and the nodes they created, over all candidates */
+    int numAttempts;
+    unsigned long long numNodesCreated;
+
+    /* Wall clock time spent packing, in milliseconds */
+    double packTime;
+  };
+
+  /*
+   * tryCreate()
+   *
+   * Try to fit the rectangles in the list into an area of the given
+   * dimension using the given packer, replacing whatever it held.
+   *
+   * Returns true if successfully fitted all. On failure the rectangle that
+   * did not fit and its position in the list are stored in failedRect and
+   * failedAt.
+   */
+  static bool tryCreate(int w, int h,
+                        std::vector<Atlas::NodeRect *> &rectList,
+                        Atlas::Packer *packer, Atlas::NodeRect **failedRect,
+                        int *failedAt);
+
+  /*
+   * findBestFit()
+   *
+   * Find the atlas size with the least waste that fits all rectangles in
+   * the list, which should be sorted for packing.
+   *
+   * Returns true and fills in the result if found, false if the
+   * rectangles do not fit in the largest atlas size.
+   */
+  static bool findBestFit(std::vector<Atlas::NodeRect *> &rectList,
+                          Options *options, Result *result);
+
+  /*
+   * findBestHeuristic()
+   *
+   * Like findBestFit(), but sorts the rectangles in each order and, with
+   * the guillotine packer, tries each split rule, until the time budget
+   * of the options runs out. The packing with the least waste is kept,
+   * ties go to the heuristic tried first. Width order with the split rule
+   * of the options is always tried. The list itself is not reordered.
+   *
+   * How many heuristics fit in the budget depends on the speed of the
+   * machine, so two runs with the same budget can give different results.
+   *
+   * With no time budget this is findBestFit() on the list as given.
+   */
+  static bool findBestHeuristic(std::vector<Atlas::NodeRect *> &rectList,
+                                Options *options, Result *result);
+
+  /*
+   * sortRects()
+   *
+   * Stable sort the rectangles from largest to smallest in an order.
+   */
+  static void sortRects(std::vector<Atlas::NodeRect *> &rectList,
+                        Order order);
+
+  /*
+   * getOrderName()
+   *
+   * Name of an order for reports (width, height, area, max-side,
+   * perimeter).
+   */
+  static const char *getOrderName(Order order);
+
+  /*
+   * getOrderByName()
+   *
+   * Order by its name, the reverse of getOrderName(). Returns -1 if
+   * unknown.
+   */
+  static int getOrderByName(const char *name);
+
+  /*
+   * fillPage()
+   *
+   * Fill an atlas of the largest size with the rectangles in the list that
+   * fit, in list order. Rectangles that do not fit are added to the spill
+   * list.
+   */
+  static void fillPage(std::vector<Atlas::NodeRect *> &rectList,
+                       std::vector<Atlas::NodeRect *> *spillList,
+                       Options *options, Result *result);
+
+  /*
+   * getTimeMs()
+   *
+   * Get a monotonic time stamp in milliseconds.
+   */
+  static double getTimeMs();
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include <limits.h>
+#include <stdio.h>
+
+#include "Packer.h"
+
+using namespace Atlas;
+
+/*
+ * Skyline packer
+ *
+ * The top edge of the packed area is kept as a list of horizontal
+ * segments. Each rectangle is put where its top ends up lowest (bottom
+ * left rule, the narrowest segment wins a tie) and the skyline is raised
+ * under it. Space below the skyline is never reused.
+ */
+
+void SkylinePacker::reset(int width, int height, int numRects)
+{
+  mWidth = width;
+  mHeight = height;
+
+  Segment segment = {0, 0, width};
+  mSkyline.clear();
+  mSkyline.push_back(segment);
+  mPlacements.clear();
+  mPlacements.reserve(numRects);
+}
+
+/*
+ * Get the top coordinate a w x h rectangle would get if its left edge is
+ * put at the start of the given segment, -1 if it does not fit there.
+ */
+int SkylinePacker::fitsAt(int index, int w, int h)
+{
+  int left = mSkyline[index].left;
+  if (left + w > mWidth) {
+    return -1;
+  }
+
+  int top = 0;
+  int widthLeft = w;
+  size_t i = index;
+  while (widthLeft > 0) {
+    if (mSkyline[i].top > top) {
+      top = mSkyline[i].top;
+    }
+    if (top + h > mHeight) {
+      return -1;
+    }
+    widthLeft -= mSkyline[i].width;
+    i++;
+  }
+
+  return top;
+}
+
+/*
+ * Find where a w x h rectangle ends lowest. Only updates the best
+ * position if better than the one given.
+ */
+bool SkylinePacker::findPosition(int w, int h, int *bestIndex, int *bestTop,
+                                 int *bestBottom, int *bestWidth)
+{
+  bool found = false;
+
+  for (size_t i = 0; i < mSkyline.size(); i++) {
+    int top = fitsAt(i, w, h);
+    if (top < 0) {
+      continue;
+    }
+    if (top + h < *bestBottom ||
+        (top + h == *bestBottom && mSkyline[i].width < *bestWidth)) {
+      *bestIndex = i;
+      *bestBottom = top + h;
+      *bestWidth = mSkyline[i].width;
+      *bestTop = top;
+      found = true;
+    }
+  }
+
+  return found;
+}
+
+bool SkylinePacker::insert(NodeRect *rect)
+{
+  int w = rect->getWidth();
+  int h = rect->getHeight();
+  int bestIndex = -1;
+  int bestBottom = INT_MAX;
+  int bestWidth = INT_MAX;
+  int bestTop = 0;
+  bool rotated = false;
+
+  findPosition(w, h, &bestIndex, &bestTop, &bestBottom, &bestWidth);
+  if (mAllowRotate && w != h &&
+      findPosition(h, w, &bestIndex, &bestTop, &bestBottom, &bestWidth)) {
+    rotated = true;
+    w = rect->getHeight();
+    h = rect->getWidth();
+  }
+
+  if (bestIndex < 0) {
+    return false;
+  }
+
+  int left = mSkyline[bestIndex].left;
+  addLevel(bestIndex, left, bestTop, w, h);
+
+  Placement placement = {rect, left, bestTop, w, h, rotated};
+  mPlacements.push_back(placement);
+  return true;
+}
+
+/*
+ * Raise the skyline under a rectangle placed at the start of segment index
+ */
+void SkylinePacker::addLevel(int index, int left, int top, int w, int h)
+{
+  Segment segment = {left, top + h, w};
+  mSkyline.insert(mSkyline.begin() + index, segment);
+
+  /* Shrink or remove the segments now under the new one */
+  size_t i = index + 1;
+  while (i < mSkyline.size()) {
+    Segment &next = mSkyline[i];
+    int end = left + w;
+    if (next.left >= end) {
+      break;
+    }
+    int shrink = end - next.left;
+    if (shrink >= next.width) {
+      mSkyline.erase(mSkyline.begin() + i);
+    } else {
+      next.left += shrink;
+      next.width -= shrink;
+      break;
+    }
+  }
+
+  /* Merge neighbours at the same height */
+  for (i = 0; i + 1 < mSkyline.size();) {
+    if (mSkyline[i].top == mSkyline[i + 1].top) {
+      mSkyline[i].width += mSkyline[i + 1].width;
+      mSkyline.erase(mSkyline.begin() + i + 1);
+    } else {
+      i++;
+    }
+  }
+}
+
+void SkylinePacker::getPlacements(std::vector<Placement> *placements)
+{
+  *placements = mPlacements;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "Stats.h"
+
+static const char *phaseNames[Stats::NumPhases] = {
+    "cache", "load", "search", "write", "index",
+};
+
+Stats::Stats()
+{
+  numImages = 0;
+  numPages = 0;
+  numAttempts = 0;
+  numNodes = 0;
+  numPixels = 0;
+  atlasArea = 0;
+
+  for (int i = 0; i < NumPhases; i++) {
+    mPhases[i].wallMs = 0.0;
+    mPhases[i].cpuMs = 0.0;
+    mPhases[i].wallStart = 0.0;
+    mPhases[i].cpuStart = 0.0;
+  }
+  mDrawMs = 0.0;
+  mEncodeMs = 0.0;
+  mWallStart = getWallTimeMs();
+  mCpuStart = getCpuTimeMs();
+  mStatus = "failed";
+}
+
+double Stats::getWallTimeMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+double Stats::getCpuTimeMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+long Stats::getPeakRssKb()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0;
+  }
+  return usage.ru_maxrss;
+}
+
+void Stats::beginPhase(Phase phase)
+{
+  mPhases[phase].wallStart = getWallTimeMs();
+  mPhases[phase].cpuStart = getCpuTimeMs();
+}
+
+void Stats::endPhase(Phase phase)
+{
+  mPhases[phase].wallMs += getWallTimeMs() - mPhases[phase].wallStart;
+  mPhases[phase].cpuMs += getCpuTimeMs() - mPhases[phase].cpuStart;
+}
+
+void Stats::addPageTime(double drawMs, double encodeMs)
+{
+  mDrawMs += drawMs;
+  mEncodeMs += encodeMs;
+}
+
+void Stats::addFile(const char *fileName)
+{
+  struct stat st;
+  File file;
+  file.name = fileName;
+  file.size = stat(fileName, &st) ? 0 : (long long)st.st_size;
+
+  /* A file written twice (e.g. an updated page) is counted once */
+  for (size_t i = 0; i < mFiles.size(); i++) {
+    if (mFiles[i].name == file.name) {
+      mFiles[i].size = file.size;
+      return;
+    }
+  }
+  mFiles.push_back(file);
+}
+
+/*
+ * Write a string as a JSON string literal
+ */
+static void putString(FILE *fp, const std::string &str)
+{
+  fputc('"', fp);
+  for (size_t i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      fprintf(fp, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(fp, "\\u%04x", c);
+    } else {
+      fputc(c, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+int Stats::save(const char *fileName)
+{
+  FILE *fp = fopen(fileName, "w");
+  if (!fp) {
+    return -1;
+  }
+
+  long long bytesWritten = 0;
+  for (size_t i = 0; i < mFiles.size(); i++) {
+    bytesWritten += mFiles[i].size;
+  }
+
+  fprintf(fp, "{\n  \"status\": ");
+  putString(fp, mStatus);
+  fprintf(fp, ",\n  \"wallMs\": %.3f,\n  \"cpuMs\": %.3f,\n",
+          getWallTimeMs() - mWallStart, getCpuTimeMs() - mCpuStart);
+  fprintf(fp, "  \"peakRssKb\": %ld,\n", getPeakRssKb());
+
+  fprintf(fp, "  \"phases\": {\n");
+  for (int i = 0; i < NumPhases; i++) {
+    fprintf(fp, "    \"%s\": {\"wallMs\": %.3f, \"cpuMs\": %.3f", phaseNames[i],
+            mPhases[i].wallMs, mPhases[i].cpuMs);
+    if (i == PhaseWrite) {
+      fprintf(fp, ", \"drawMs\": %.3f, \"encodeMs\": %.3f", mDrawMs,
+              mEncodeMs);
+    }
+    fprintf(fp, "}%s\n", i < NumPhases - 1 ? "," : "");
+  }
+  fprintf(fp, "  },\n");
+
+  fprintf(fp,
+          "  \"images\": %d,\n  \"pages\": %d,\n  \"attempts\": %lld,\n"
+          "  \"nodes\": %llu,\n  \"occupancy\": %.4f,\n",
+          numImages, numPages, numAttempts, numNodes,
+          atlasArea ? (double)numPixels / (double)atlasArea : 0.0);
+
+  fprintf(fp, "  \"bytesWritten\": %lld,\n  \"files\": [", bytesWritten);
+  for (size_t i = 0; i < mFiles.size(); i++) {
+    fprintf(fp, "%s\n    {\"name\": ", i ? "," : "");
+    putString(fp, mFiles[i].name);
+    fprintf(fp, ", \"bytes\": %lld}", mFiles[i].size);
+  }
+  fprintf(fp, "%s]\n}\n", mFiles.empty() ? "" : "\n  ");
+
+  if (fclose(fp)) {
+    return -1;
+  }
+  return 0;
+}
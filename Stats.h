@@ -0,0 +1,82 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <string>
+#include <vector>
+
+/*
+ * Timing and statistics of one run, written as JSON for build dashboards
+ */
+class Stats {
+
+public:
+  enum Phase {
+    PhaseCache,  /* Checking, and maybe updating, the previous run */
+    PhaseLoad,   /* Stat and decode the images */
+    PhaseSearch, /* Trim, dedup and pack the images */
+    PhaseWrite,  /* Draw and encode the pages */
+    PhaseIndex,  /* Write the sprite index and the cache */
+    NumPhases,
+  };
+
+  Stats();
+
+  /*
+   * Time a phase, from the calling thread. Wall time and the CPU time of
+   * the whole process (every thread) are added to the phase.
+   */
+  void beginPhase(Phase phase);
+  void endPhase(Phase phase);
+
+  /*
+   * Time spent drawing and encoding pages, summed over the pages. Pages
+   * are written side by side, so the sums may exceed the write phase.
+   */
+  void addPageTime(double drawMs, double encodeMs);
+
+  /* Record a file written by the run, with its size on disk */
+  void addFile(const char *fileName);
+
+  /* What the run did: "built", "updated", "up to date" or "failed" */
+  void setStatus(const char *status) { mStatus = status; }
+
+  /* Counters, filled in by the caller */
+  int numImages;
+  int numPages;
+  long long numAttempts;        /* tryCreate() calls */
+  unsigned long long numNodes;  /* Packer nodes created by all attempts */
+  unsigned long long numPixels; /* Packed area of the sprites */
+  unsigned long long atlasArea; /* Area of all pages */
+
+  /*
+   * save()
+   *
+   * Write the statistics as JSON. Returns 0 on success.
+   */
+  int save(const char *fileName);
+
+  static double getWallTimeMs();
+  static double getCpuTimeMs();
+
+  /* Largest resident set size of the process so far, in kilobytes */
+  static long getPeakRssKb();
+
+private:
+  struct PhaseTime {
+    double wallMs, cpuMs;
+    double wallStart, cpuStart;
+  };
+
+  struct File {
+    std::string name;
+    long long size;
+  };
+
+  PhaseTime mPhases[NumPhases];
+  double mDrawMs, mEncodeMs;
+  double mWallStart, mCpuStart;
+  std::vector<File> mFiles;
+  std::string mStatus;
+};
+
+#endif
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "Blit.h"
+#include "Hash.h"
+#include "Parallel.h"
+#include "TextureAtlas.h"
+#include "Trim.h"
+
+/*
+ * Alpha bits of a pixel, the byte order in memory is R, G, B, A whatever
+ * the host byte order
+ */
+static uint32_t getAlphaMask()
+{
+  static const uint8_t bytes[4] = {0x00, 0x00, 0x00, 0xff};
+  uint32_t mask;
+  memcpy(&mask, bytes, sizeof(mask));
+  return mask;
+}
+
+/*
+ * Image atlas node
+ */
+class Image : public Atlas::NodeRect {
+public:
+  Image(int input, const TextureAtlas::Input *source)
+      : NodeRect(source->width, source->height)
+  {
+    mSource = source;
+    mInput = input;
+    mTrimLeft = 0;
+    mTrimTop = 0;
+    mPixelWidth = source->width;
+    mPixelHeight = source->height;
+    mHash = 0;
+  }
+
+  /*
+   * Shrink the image to the bounding box of its pixels that are not fully
+   * transparent
+   */
+  void trim()
+  {
+    TextureAtlas::findSpriteArea(mSource, true, &mTrimLeft, &mTrimTop,
+                                 &mPixelWidth, &mPixelHeight);
+    setSize(mPixelWidth, mPixelHeight);
+  }
+
+  /* Pack the image with a border of the given width on each side */
+  void extrude(int border)
+  {
+    setSize(getWidth() + 2 * border, getHeight() + 2 * border);
+  }
+
+  /*
+   * Pack the image in an area with a size that is a multiple of the given
+   * one, the pixels stay at the top left of it
+   */
+  void pad(int multiple)
+  {
+    setSize((getWidth() + multiple - 1) / multiple * multiple,
+            (getHeight() + multiple - 1) / multiple * multiple);
+  }
+
+  /* Size of the (trimmed) pixels, the packed size may be padded */
+  int getPixelWidth() { return mPixelWidth; }
+  int getPixelHeight() { return mPixelHeight; }
+
+  /* Area of the source that goes to the atlas */
+  int getTrimLeft() { return mTrimLeft; }
+  int getTrimTop() { return mTrimTop; }
+  int getSourceWidth() { return mSource->width; }
+  int getSourceHeight() { return mSource->height; }
+
+  bool hasPixels() { return mSource->pixels != NULL; }
+
+  /* Get a pointer to the first pixel of a row of the (trimmed) image */
+  const uint32_t *getRow(int y)
+  {
+    return (const uint32_t *)((const uint8_t *)mSource->pixels +
+                              (mTrimTop + y) * mSource->pitch) +
+           mTrimLeft;
+  }
+
+  /* Hash the (trimmed) pixels */
+  void hashPixels()
+  {
+    int size[2] = {mPixelWidth, mPixelHeight};
+    mHash = Hash::hash64(size, sizeof(size));
+    for (int y = 0; y < mPixelHeight; y++) {
+      mHash = Hash::hash64(getRow(y), mPixelWidth * sizeof(uint32_t), mHash);
+    }
+  }
+
+  uint64_t getHash() { return mHash; }
+
+  /* Compare the (trimmed) pixels with those of another image */
+  bool hasSamePixels(Image *image)
+  {
+    if (image->getPixelWidth() != mPixelWidth ||
+        image->getPixelHeight() != mPixelHeight) {
+      return false;
+    }
+    for (int y = 0; y < mPixelHeight; y++) {
+      if (memcmp(getRow(y), image->getRow(y),
+                 mPixelWidth * sizeof(uint32_t))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*
+   * Images with the same pixels as this one. They are not packed, but
+   * get sprites sharing this image's place in the atlas.
+   */
+  void addDuplicate(Image *image) { mDuplicates.push_back(image); }
+  std::vector<Image *> &getDuplicates() { return mDuplicates; }
+
+  const char *getName() { return mSource->name ? mSource->name : ""; }
+
+  /* Position of the image in the inputs */
+  int getInput() { return mInput; }
+
+private:
+  const TextureAtlas::Input *mSource;
+  int mInput;
+  int mTrimLeft, mTrimTop;
+  int mPixelWidth, mPixelHeight;
+  uint64_t mHash;
+  std::vector<Image *> mDuplicates;
+};
+
+void TextureAtlas::getDefaultOptions(Options *options)
+{
+  options->search = Search::StrategyPruned;
+  options->packer = Atlas::PackerGuillotine;
+  options->allowRotate = false;
+  options->npot = false;
+  options->align = 1;
+  options->pad = 1;
+  options->extrude = 0;
+  options->trim = false;
+  options->dedup = false;
+  options->maxSize = 8192;
+  options->jobs = 1;
+  options->composite = false;
+  options->verbose = false;
+  options->timeBudget = 0;
+}
+
+void TextureAtlas::findSpriteArea(const Input *input, bool trim, int *left,
+                                  int *top, int *width, int *height)
+{
+  *left = 0;
+  *top = 0;
+  *width = input->width;
+  *height = input->height;
+
+  if (trim && input->pixels) {
+    int right, bottom;
+    Trim::findOpaqueArea(input->pixels, input->pitch, input->width,
+                         input->height, getAlphaMask(), left, top, &right,
+                         &bottom);
+    *width = right - *left;
+    *height = bottom - *top;
+  }
+}
+
+void TextureAtlas::drawSprite(const Input *input, const SpriteRecord *sprite,
+                              uint32_t *pixels, int pitch)
+{
+  if (!input->pixels) {
+    return;
+  }
+
+  const uint32_t *src =
+      (const uint32_t *)((const uint8_t *)input->pixels +
+                         sprite->trimTop * input->pitch) +
+      sprite->trimLeft;
+  uint32_t *dst =
+      (uint32_t *)((uint8_t *)pixels + sprite->top * pitch) + sprite->left;
+
+  if (!sprite->rotated) {
+    Blit::copy(src, input->pitch, dst, pitch, sprite->width, sprite->height);
+  } else {
+    /* Width and height are those of the turned pixels */
+    Blit::copyRotated(src, input->pitch, dst, pitch, sprite->height,
+                      sprite->width);
+  }
+}
+
+void TextureAtlas::extrudeSprite(const SpriteRecord *sprite, int extrude,
+                                 uint32_t *pixels, int pitch)
+{
+  if (extrude <= 0) {
+    return;
+  }
+
+  /* Left and right of each row, then whole rows above and below */
+  int left = sprite->left;
+  int right = sprite->left + sprite->width;
+  for (int y = sprite->top; y < sprite->top + sprite->height; y++) {
+    uint32_t *row = (uint32_t *)((uint8_t *)pixels + y * pitch);
+    for (int x = 1; x <= extrude; x++) {
+      row[left - x] = row[left];
+      row[right - 1 + x] = row[right - 1];
+    }
+  }
+
+  int rowBytes = (sprite->width + 2 * extrude) * sizeof(uint32_t);
+  uint8_t *first =
+      (uint8_t *)pixels + sprite->top * pitch + (left - extrude) * 4;
+  uint8_t *last = first + (sprite->height - 1) * pitch;
+  for (int y = 1; y <= extrude; y++) {
+    memcpy(first - y * pitch, first, rowBytes);
+    memcpy(last + y * pitch, last, rowBytes);
+  }
+}
+
+struct DrawParams {
+  const std::vector<TextureAtlas::Input> *inputs;
+  std::vector<SpriteRecord> *sprites;
+  std::vector<int> *pageSprites;
+  uint32_t *pixels;
+  int pitch;
+  int extrude;
+};
+
+static void drawPageSprite(int index, int worker, void *param)
+{
+  struct DrawParams *params = (struct DrawParams *)param;
+  SpriteRecord *sprite = &(*params->sprites)[(*params->pageSprites)[index]];
+  const TextureAtlas::Input *input = &(*params->inputs)[sprite->input];
+  if (input->pixels) {
+    TextureAtlas::drawSprite(input, sprite, params->pixels, params->pitch);
+    TextureAtlas::extrudeSprite(sprite, params->extrude, params->pixels,
+                                params->pitch);
+  }
+}
+
+void TextureAtlas::drawPage(const std::vector<Input> &inputs, Result *result,
+                            int page, uint32_t *pixels, int pitch, int jobs)
+{
+  Page *atlasPage = &result->pages[page];
+
+  for (int y = 0; y < atlasPage->height; y++) {
+    memset((uint8_t *)pixels + y * pitch, 0,
+           atlasPage->width * sizeof(uint32_t));
+  }
+
+  /* Sprites never overlap, draw them side by side */
+  struct DrawParams drawParams;
+  drawParams.inputs = &inputs;
+  drawParams.sprites = &result->sprites;
+  drawParams.pageSprites = &atlasPage->sprites;
+  drawParams.pixels = pixels;
+  drawParams.pitch = pitch;
+  drawParams.extrude = result->extrude;
+  Parallel::forEach(atlasPage->sprites.size(), jobs, drawPageSprite,
+                    &drawParams);
+}
+
+/*
+ * Describe an image the way it is placed in the atlas
+ */
+static void setSpriteRecord(SpriteRecord *sprite, Atlas::Placement *placement,
+                            Image *image, int page, int extrude)
+{
+  sprite->name = image->getName();
+  sprite->input = image->getInput();
+  sprite->page = page;
+  sprite->left = placement->left + extrude;
+  sprite->top = placement->top + extrude;
+  sprite->width =
+      placement->rotated ? image->getPixelHeight() : image->getPixelWidth();
+  sprite->height =
+      placement->rotated ? image->getPixelWidth() : image->getPixelHeight();
+  sprite->rotated = placement->rotated;
+  sprite->trimLeft = image->getTrimLeft();
+  sprite->trimTop = image->getTrimTop();
+  sprite->sourceWidth = image->getSourceWidth();
+  sprite->sourceHeight = image->getSourceHeight();
+  sprite->slotWidth = placement->width;
+  sprite->slotHeight = placement->height;
+}
+
+/*
+ * Add a page with the sprites of its placed images and of all their
+ * duplicates
+ */
+static void addPage(Search::Result *search, TextureAtlas::Result *result)
+{
+  TextureAtlas::Page page;
+  int pageIndex = result->pages.size();
+  page.width = search->width;
+  page.height = search->height;
+
+  for (size_t i = 0; i < search->placements.size(); i++) {
+    Atlas::Placement *placement = &search->placements[i];
+    Image *image = (Image *)placement->rect;
+    std::vector<Image *> &duplicates = image->getDuplicates();
+    SpriteRecord sprite;
+
+    page.sprites.push_back(result->sprites.size());
+    setSpriteRecord(&sprite, placement, image, pageIndex, result->extrude);
+    result->sprites.push_back(sprite);
+    for (size_t j = 0; j < duplicates.size(); j++) {
+      setSpriteRecord(&sprite, placement, duplicates[j], pageIndex,
+                      result->extrude);
+      result->sprites.push_back(sprite);
+    }
+  }
+
+  result->pages.push_back(page);
+}
+
+struct PrepareParams {
+  TextureAtlas::Options *options;
+  std::vector<Image> *images;
+};
+
+static void prepareImage(int index, int worker, void *param)
+{
+  struct PrepareParams *params = (struct PrepareParams *)param;
+  Image *image = &(*params->images)[index];
+
+  if (params->options->trim && image->hasPixels()) {
+    image->trim();
+  }
+  if (params->options->extrude > 0) {
+    image->extrude(params->options->extrude);
+  }
+  if (params->options->pad > 1) {
+    /* E.g. keep each image in compression blocks of its own */
+    image->pad(params->options->pad);
+  }
+  if (params->options->dedup && image->hasPixels()) {
+    image->hashPixels();
+  }
+}
+
+int TextureAtlas::pack(const std::vector<Input> &inputs, Options *options,
+                       Result *result)
+{
+  int numInputs = inputs.size();
+
+  result->pages.clear();
+  result->sprites.clear();
+  result->numDuplicates = 0;
+  result->numAttempts = 0;
+  result->numNodesCreated = 0;
+  result->numPixels = 0;
+  result->failedInput = -1;
+  result->extrude = options->extrude;
+
+  std::vector<Image> images;
+  images.reserve(numInputs);
+  for (int i = 0; i < numInputs; i++) {
+    images.push_back(Image(i, &inputs[i]));
+  }
+
+  /* Trim and hash the images in parallel */
+  struct PrepareParams prepareParams;
+  prepareParams.options = options;
+  prepareParams.images = &images;
+  Parallel::forEach(numInputs, options->jobs, prepareImage, &prepareParams);
+
+  /*
+   * With dedup, images with the same pixels as an earlier input are made
+   * duplicates of that one instead of being packed.
+   */
+  std::unordered_map<uint64_t, std::vector<Image *> > uniqueImages;
+  std::vector<Atlas::NodeRect *> imageList;
+  imageList.reserve(numInputs);
+
+  for (int i = 0; i < numInputs; i++) {
+    Image *image = &images[i];
+
+    if (options->dedup && image->hasPixels()) {
+      std::vector<Image *> &sameHash = uniqueImages[image->getHash()];
+      Image *original = NULL;
+      for (size_t j = 0; j < sameHash.size() && !original; j++) {
+        if (sameHash[j]->hasSamePixels(image)) {
+          original = sameHash[j];
+        }
+      }
+      if (original) {
+        original->addDuplicate(image);
+        result->numDuplicates++;
+        continue;
+      }
+      sameHash.push_back(image);
+    }
+
+    imageList.push_back(image);
+  }
+
+  if (options->dedup && options->verbose) {
+    printf("Found %d duplicate images\n", result->numDuplicates);
+  }
+
+  Search::sortRects(imageList, Search::OrderWidth);
+
+  /*
+   * Find the best fit for all images. If they do not fit in the largest
+   * page size, fill pages of the largest size until the rest fits.
+   */
+
+  Search::Options searchOptions;
+  searchOptions.strategy = options->search;
+  searchOptions.packer = options->packer;
+  searchOptions.splitRule = Atlas::SplitLargerLeftover;
+  searchOptions.allowRotate = options->allowRotate;
+  searchOptions.npot = options->npot;
+  searchOptions.align = options->align;
+  searchOptions.maxSize = options->maxSize;
+  searchOptions.jobs = options->jobs;
+  searchOptions.verbose = options->verbose;
+  searchOptions.timeBudget = options->timeBudget;
+
+  while (!imageList.empty()) {
+    Search::Result search;
+
+    bool fitted =
+        Search::findBestHeuristic(imageList, &searchOptions, &search);
+    result->numAttempts += search.numAttempts;
+    result->numNodesCreated += search.numNodesCreated;
+
+    if (fitted) {
+      result->numPixels += search.numPixels;
+      addPage(&search, result);
+      break;
+    }
+
+    std::vector<Atlas::NodeRect *> spillList;
+    Search::fillPage(imageList, &spillList, &searchOptions, &search);
+    result->numAttempts += search.numAttempts;
+    result->numNodesCreated += search.numNodesCreated;
+    result->numPixels += search.numPixels;
+    if (search.placements.empty()) {
+      result->failedInput = ((Image *)imageList.front())->getInput();
+      return -1;
+    }
+
+    if (options->verbose) {
+      printf("Filled page %d with %d images, %d left for the next page\n",
+             (int)result->pages.size(), (int)search.placements.size(),
+             (int)spillList.size());
+    }
+    addPage(&search, result);
+    imageList.swap(spillList);
+  }
+
+  if (options->composite) {
+    for (size_t i = 0; i < result->pages.size(); i++) {
+      Page *page = &result->pages[i];
+      page->pixels.resize((size_t)page->width * page->height);
+      drawPage(inputs, result, i, &page->pixels[0],
+               page->width * sizeof(uint32_t), options->jobs);
+    }
+  }
+
+  return 0;
+}
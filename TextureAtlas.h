@@ -0,0 +1,167 @@
+#ifndef _TEXTUREATLAS_H_
+#define _TEXTUREATLAS_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Packer.h"
+#include "Search.h"
+
+/*
+ * A sprite as it is written to the atlas index
+ */
+struct SpriteRecord {
+  std::string name;
+
+  /* Input the sprite comes from */
+  int input;
+
+  int page;
+  int left, top, width, height;
+  int rotated;
+  int trimLeft, trimTop;
+  int sourceWidth, sourceHeight;
+
+  /*
+   * Area the packer reserved for the sprite, from the extruded border
+   * above and left of it. Equal to the sprite area and its border when
+   * packed, kept when an incremental rebuild puts a smaller image in the
+   * same place.
+   */
+  int slotWidth, slotHeight;
+};
+
+/*
+ * Texture atlas packing on images in memory. Nothing is read from or
+ * written to disk, see the textureatlas tool for that.
+ *
+ * Pixels are 32 bits with the bytes in R, G, B, A order in memory
+ * (SDL_PIXELFORMAT_RGBA32).
+ */
+class TextureAtlas {
+
+public:
+  struct Options {
+    Search::Strategy search;
+    Atlas::PackerType packer;
+    bool allowRotate;
+    bool npot;      /* Any multiple of align instead of powers of two */
+    int align;      /* Multiple of the page size with npot */
+    int pad;        /* Pack images in areas a multiple of pad in size */
+    int extrude;    /* Border of repeated edge pixels around each image */
+    bool trim;      /* Pack images without their transparent borders */
+    bool dedup;     /* Pack images with the same pixels only once */
+    int maxSize;    /* Largest page width and height */
+    int jobs;       /* Threads to use, <= 0 for one per hardware thread */
+    bool composite; /* Draw the pages into the result */
+    bool verbose;   /* Print the dimensions tried and other progress */
+
+    /*
+     * Milliseconds to spend trying other image orders and split rules
+     * for a smaller atlas, 0 for the default order only. The result then
+     * depends on the speed of the machine.
+     */
+    int timeBudget;
+  };
+
+  struct Input {
+    const char *name; /* Sprite name, may be NULL */
+    int width, height;
+
+    /*
+     * Pixels of the image, pitch is in bytes. May be NULL to only pack
+     * sizes, such inputs are never trimmed, deduplicated or drawn.
+     */
+    const uint32_t *pixels;
+    int pitch;
+  };
+
+  struct Page {
+    int width, height;
+
+    /* Indexes of the sprites to draw on the page, duplicates left out */
+    std::vector<int> sprites;
+
+    /* The composited page (pitch width * 4), empty if not asked for */
+    std::vector<uint32_t> pixels;
+  };
+
+  struct Result {
+    std::vector<Page> pages;
+
+    /* By page, then in packing order, duplicates after their original */
+    std::vector<SpriteRecord> sprites;
+
+    int numDuplicates;
+
+    /* Search statistics, summed over the pages */
+    int numAttempts;
+    unsigned long long numNodesCreated;
+    unsigned long long numPixels; /* Packed area of the sprites */
+
+    /* On failure, the input that does not fit the largest page */
+    int failedInput;
+
+    /* Border drawn around the sprites, from the options */
+    int extrude;
+  };
+
+  /*
+   * getDefaultOptions()
+   *
+   * Fill in the options the textureatlas tool uses when given none.
+   */
+  static void getDefaultOptions(Options *options);
+
+  /*
+   * pack()
+   *
+   * Pack the inputs in as few pages as possible, each of the size with
+   * the least waste. Every input gets one sprite.
+   *
+   * Returns 0 on success, -1 if an input does not fit in a page of the
+   * largest size (failedInput tells which).
+   */
+  static int pack(const std::vector<Input> &inputs, Options *options,
+                  Result *result);
+
+  /*
+   * drawPage()
+   *
+   * Draw the sprites of a packed page, cleared to transparent first, into
+   * a buffer of the page size. pitch is in bytes.
+   */
+  static void drawPage(const std::vector<Input> &inputs, Result *result,
+                       int page, uint32_t *pixels, int pitch, int jobs);
+
+  /*
+   * drawSprite()
+   *
+   * Draw the pixels of an input to the place of a sprite, as it is
+   * described by the sprite (trim area, size and rotation).
+   */
+  static void drawSprite(const Input *input, const SpriteRecord *sprite,
+                         uint32_t *pixels, int pitch);
+
+  /*
+   * extrudeSprite()
+   *
+   * Fill a border of the given width around a drawn sprite with copies of
+   * its edge pixels, so filtering at the sprite's edges does not pick up
+   * its neighbours.
+   */
+  static void extrudeSprite(const SpriteRecord *sprite, int extrude,
+                            uint32_t *pixels, int pitch);
+
+  /*
+   * findSpriteArea()
+   *
+   * Area of an input that goes to the atlas: left/top and the size of the
+   * pixels, after trimming if asked for.
+   */
+  static void findSpriteArea(const Input *input, bool trim, int *left,
+                             int *top, int *width, int *height);
+};
+
+#endif
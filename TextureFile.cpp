@@ -0,0 +1,275 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Bytes.h"
+#include "TextureFile.h"
+
+/* DDS header flags */
+#define DDSD_CAPS 0x1
+#define DDSD_HEIGHT 0x2
+#define DDSD_WIDTH 0x4
+#define DDSD_PITCH 0x8
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_ALPHAPIXELS 0x1
+#define DDPF_ALPHA 0x2
+#define DDPF_FOURCC 0x4
+#define DDPF_RGB 0x40
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+#define DXGI_FORMAT_BC7_UNORM 98
+#define D3D10_RESOURCE_DIMENSION_TEXTURE2D 3
+
+/* KTX2 and its data format descriptor */
+#define VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK 151
+#define KHR_DF_MODEL_ETC2 161
+#define KHR_DF_PRIMARIES_BT709 1
+#define KHR_DF_TRANSFER_LINEAR 1
+#define KHR_DF_CHANNEL_ETC2_COLOR 2
+#define KHR_DF_CHANNEL_ETC2_ALPHA 15
+
+static uint32_t makeFourCC(const char *code)
+{
+  return code[0] | code[1] << 8 | code[2] << 16 | (uint32_t)code[3] << 24;
+}
+
+/*
+ * DDS pixel format: a four character code for block compressed formats,
+ * else the bits of each channel
+ */
+struct DDSFormat {
+  uint32_t flags;
+  const char *fourCC;
+  int bitCount;
+  uint32_t masks[4]; /* R, G, B, A */
+  int dxgiFormat;    /* For a DX10 extension header, 0 for none */
+  int pixelBytes;    /* 0 for block compressed formats */
+};
+
+/*
+ * DDS: a fixed header, DX10 extension header for BC7, then the levels from
+ * the largest down
+ */
+static void makeDDSHeader(const struct DDSFormat *format,
+                          const std::vector<TextureFile::Level> &levels,
+                          std::vector<uint8_t> *header)
+{
+  bool mipmaps = levels.size() > 1;
+  bool compressed = format->pixelBytes == 0;
+
+  putUint32(header, makeFourCC("DDS "));
+  putUint32(header, 124);
+  putUint32(header, DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT |
+                        (compressed ? DDSD_LINEARSIZE : DDSD_PITCH) |
+                        (mipmaps ? DDSD_MIPMAPCOUNT : 0));
+  putUint32(header, levels[0].height);
+  putUint32(header, levels[0].width);
+  putUint32(header, compressed ? levels[0].size
+                               : levels[0].width * format->pixelBytes);
+  putUint32(header, 0); /* Depth */
+  putUint32(header, levels.size());
+  for (int i = 0; i < 11; i++) {
+    putUint32(header, 0); /* Reserved */
+  }
+
+  /* Pixel format */
+  putUint32(header, 32);
+  putUint32(header, format->flags);
+  putUint32(header, format->fourCC ? makeFourCC(format->fourCC) : 0);
+  putUint32(header, format->bitCount);
+  for (int i = 0; i < 4; i++) {
+    putUint32(header, format->masks[i]);
+  }
+
+  putUint32(header, DDSCAPS_TEXTURE |
+                        (mipmaps ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0));
+  for (int i = 0; i < 4; i++) {
+    putUint32(header, 0); /* Caps 2-4 and reserved */
+  }
+
+  if (format->dxgiFormat) {
+    putUint32(header, format->dxgiFormat);
+    putUint32(header, D3D10_RESOURCE_DIMENSION_TEXTURE2D);
+    putUint32(header, 0); /* Misc flags */
+    putUint32(header, 1); /* Array size */
+    putUint32(header, 0); /* Misc flags 2 */
+  }
+}
+
+static int saveDDS(FILE *fp, const struct DDSFormat *format,
+                   const std::vector<TextureFile::Level> &levels)
+{
+  std::vector<uint8_t> header;
+  makeDDSHeader(format, levels, &header);
+  fwrite(&header[0], 1, header.size(), fp);
+
+  for (size_t i = 0; i < levels.size(); i++) {
+    fwrite(levels[i].data, 1, levels[i].size, fp);
+  }
+  return 0;
+}
+
+/*
+ * KTX2: header, level index, data format descriptor, then the levels from
+ * the smallest up, each aligned to the block size
+ */
+static int saveKTX2(FILE *fp, const std::vector<TextureFile::Level> &levels)
+{
+  static const uint8_t identifier[12] = {0xab, 'K',  'T',  'X', ' ',  '2',
+                                         '0',  0xbb, '\r', '\n', 0x1a, '\n'};
+  const int blockBytes = 16;
+  const size_t levelIndexOffset = 80;
+
+  /* Data format descriptor: ETC2 with an alpha and a color sample */
+  std::vector<uint8_t> dfd;
+  putUint32(&dfd, 0); /* Total size, set below */
+  putUint32(&dfd, 0); /* Khronos vendor, basic descriptor */
+  putUint32(&dfd, 2 | (24 + 16 * 2) << 16); /* Version 2, block size */
+  putUint32(&dfd, KHR_DF_MODEL_ETC2 | KHR_DF_PRIMARIES_BT709 << 8 |
+                      KHR_DF_TRANSFER_LINEAR << 16);
+  putUint32(&dfd, 3 | 3 << 8); /* 4x4 texel blocks */
+  putUint32(&dfd, blockBytes); /* Bytes in plane 0 */
+  putUint32(&dfd, 0);
+  static const int channels[2] = {KHR_DF_CHANNEL_ETC2_ALPHA,
+                                  KHR_DF_CHANNEL_ETC2_COLOR};
+  for (int i = 0; i < 2; i++) {
+    putUint32(&dfd, (64 * i) | 63 << 16 | channels[i] << 24);
+    putUint32(&dfd, 0);          /* Sample position */
+    putUint32(&dfd, 0);          /* Lower */
+    putUint32(&dfd, 0xffffffff); /* Upper */
+  }
+  for (int i = 0; i < 4; i++) {
+    dfd[i] = dfd.size() >> (8 * i);
+  }
+
+  size_t dfdOffset = levelIndexOffset + 24 * levels.size();
+  size_t offset = dfdOffset + dfd.size();
+  std::vector<size_t> levelOffsets(levels.size());
+  for (size_t i = levels.size(); i-- > 0;) {
+    offset = (offset + blockBytes - 1) / blockBytes * blockBytes;
+    levelOffsets[i] = offset;
+    offset += levels[i].size;
+  }
+
+  std::vector<uint8_t> header(identifier, identifier + sizeof(identifier));
+  putUint32(&header, VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK);
+  putUint32(&header, 1); /* Type size */
+  putUint32(&header, levels[0].width);
+  putUint32(&header, levels[0].height);
+  putUint32(&header, 0); /* Depth */
+  putUint32(&header, 0); /* Layers */
+  putUint32(&header, 1); /* Faces */
+  putUint32(&header, levels.size());
+  putUint32(&header, 0); /* No supercompression */
+  putUint32(&header, dfdOffset);
+  putUint32(&header, dfd.size());
+  putUint32(&header, 0); /* No key/value data */
+  putUint32(&header, 0);
+  putUint64(&header, 0); /* No supercompression global data */
+  putUint64(&header, 0);
+  for (size_t i = 0; i < levels.size(); i++) {
+    putUint64(&header, levelOffsets[i]);
+    putUint64(&header, levels[i].size);
+    putUint64(&header, levels[i].size);
+  }
+  header.insert(header.end(), dfd.begin(), dfd.end());
+  fwrite(&header[0], 1, header.size(), fp);
+
+  size_t pos = header.size();
+  static const uint8_t padding[16] = {0};
+  for (size_t i = levels.size(); i-- > 0;) {
+    fwrite(padding, 1, levelOffsets[i] - pos, fp);
+    fwrite(levels[i].data, 1, levels[i].size, fp);
+    pos = levelOffsets[i] + levels[i].size;
+  }
+  return 0;
+}
+
+/* Raw: the levels one after the other, from the largest down */
+static int writeRaw(FILE *fp, const std::vector<TextureFile::Level> &levels)
+{
+  for (size_t i = 0; i < levels.size(); i++) {
+    fwrite(levels[i].data, 1, levels[i].size, fp);
+  }
+  return 0;
+}
+
+static FILE *createFile(const char *filename)
+{
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    printf("Failed to create %s: %s\n", filename, strerror(errno));
+  }
+  return fp;
+}
+
+static int closeFile(FILE *fp, int err)
+{
+  if (ferror(fp)) {
+    err = -1;
+  }
+  if (fclose(fp) != 0) {
+    err = -1;
+  }
+  return err;
+}
+
+const char *TextureFile::getExtension(Compress::Format format)
+{
+  return format == Compress::FormatETC2 ? "ktx2" : "dds";
+}
+
+int TextureFile::save(const char *filename, Compress::Format format,
+                      const std::vector<Level> &levels)
+{
+  struct DDSFormat ddsFormat = {DDPF_FOURCC, "DX10", 0, {0, 0, 0, 0},
+                                DXGI_FORMAT_BC7_UNORM, 0};
+  if (format == Compress::FormatBC1) {
+    ddsFormat.fourCC = "DXT1";
+    ddsFormat.dxgiFormat = 0;
+  } else if (format == Compress::FormatBC3) {
+    ddsFormat.fourCC = "DXT5";
+    ddsFormat.dxgiFormat = 0;
+  }
+
+  FILE *fp = createFile(filename);
+  if (!fp) {
+    return -1;
+  }
+  return closeFile(fp, format == Compress::FormatETC2
+                           ? saveKTX2(fp, levels)
+                           : saveDDS(fp, &ddsFormat, levels));
+}
+
+int TextureFile::save(const char *filename, Convert::Format format,
+                      const std::vector<Level> &levels)
+{
+  /* By Convert::Format */
+  static const struct DDSFormat ddsFormats[] = {
+      {DDPF_RGB | DDPF_ALPHAPIXELS, NULL, 32,
+       {0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000}, 0, 4},
+      {DDPF_RGB | DDPF_ALPHAPIXELS, NULL, 16,
+       {0x0f00, 0x00f0, 0x000f, 0xf000}, 0, 2},
+      {DDPF_RGB, NULL, 16, {0xf800, 0x07e0, 0x001f, 0}, 0, 2},
+      {DDPF_ALPHA, NULL, 8, {0, 0, 0, 0xff}, 0, 1},
+  };
+
+  FILE *fp = createFile(filename);
+  if (!fp) {
+    return -1;
+  }
+  return closeFile(fp, saveDDS(fp, &ddsFormats[format], levels));
+}
+
+int TextureFile::saveRaw(const char *filename,
+                         const std::vector<Level> &levels)
+{
+  FILE *fp = createFile(filename);
+  if (!fp) {
+    return -1;
+  }
+  return closeFile(fp, writeRaw(fp, levels));
+}
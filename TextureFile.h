@@ -0,0 +1,59 @@
+#ifndef _TEXTUREFILE_H_
+#define _TEXTUREFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "Compress.h"
+#include "Convert.h"
+
+class TextureFile {
+
+public:
+  /* One mip level, level 0 is the full size image */
+  struct Level {
+    int width, height;
+    const uint8_t *data;
+    size_t size;
+  };
+
+  /*
+   * getExtension()
+   *
+   * File name extension used for a format: dds for BC formats, ktx2 for
+   * ETC2.
+   */
+  static const char *getExtension(Compress::Format format);
+
+  /*
+   * save()
+   *
+   * Save block compressed mip levels as a DDS or KTX2 file, depending on
+   * the format.
+   * Returns 0 if successfully saved, else error.
+   */
+  static int save(const char *filename, Compress::Format format,
+                  const std::vector<Level> &levels);
+
+  /*
+   * save()
+   *
+   * Save uncompressed mip levels, in a format of Convert, as a DDS file
+   * with the channel masks of the format.
+   * Returns 0 if successfully saved, else error.
+   */
+  static int save(const char *filename, Convert::Format format,
+                  const std::vector<Level> &levels);
+
+  /*
+   * saveRaw()
+   *
+   * Save mip levels as they are, one after the other from level 0 down,
+   * without a header.
+   * Returns 0 if successfully saved, else error.
+   */
+  static int saveRaw(const char *filename, const std::vector<Level> &levels);
+};
+
+#endif
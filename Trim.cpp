@@ -0,0 +1,128 @@
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Pixels.h"
+#include "Trim.h"
+
+/*
+ * Get the index of the first pixel in [start, end) with alpha set, end if
+ * there is none.
+ */
+static int findFirstOpaque(const uint32_t *row, int start, int end,
+                           uint32_t alphaMask)
+{
+  int x = start;
+
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi32(alphaMask);
+  const __m128i zero = _mm_setzero_si128();
+  for (; x + 4 <= end; x += 4) {
+    __m128i alpha =
+        _mm_and_si128(_mm_loadu_si128((const __m128i *)(row + x)), mask);
+    int transparent = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero));
+    if (transparent != 0xffff) {
+      return x + __builtin_ctz(~transparent) / 4;
+    }
+  }
+#endif
+
+  for (; x < end; x++) {
+    if (row[x] & alphaMask) {
+      break;
+    }
+  }
+  return x;
+}
+
+/*
+ * Get one past the index of the last pixel in [start, end) with alpha set,
+ * start if there is none.
+ */
+static int findLastOpaque(const uint32_t *row, int start, int end,
+                          uint32_t alphaMask)
+{
+  int x = end;
+
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi32(alphaMask);
+  const __m128i zero = _mm_setzero_si128();
+  for (; x - 4 >= start; x -= 4) {
+    __m128i alpha =
+        _mm_and_si128(_mm_loadu_si128((const __m128i *)(row + x - 4)), mask);
+    int transparent = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero));
+    if (transparent != 0xffff) {
+      return x - __builtin_clz(~(unsigned)transparent << 16) / 4;
+    }
+  }
+#endif
+
+  for (; x > start; x--) {
+    if (row[x - 1] & alphaMask) {
+      break;
+    }
+  }
+  return x;
+}
+
+bool Trim::findOpaqueArea(const uint32_t *pixels, int pitch, int width,
+                          int height, uint32_t alphaMask, int *left, int *top,
+                          int *right, int *bottom)
+{
+  int minX = width;
+  int maxX = 0;
+  int minY = 0;
+  int maxY = height - 1;
+
+  /* First row from the top with an opaque pixel */
+  for (; minY < height; minY++) {
+    const uint32_t *row = getRow(pixels, pitch, minY);
+    minX = findFirstOpaque(row, 0, width, alphaMask);
+    if (minX < width) {
+      maxX = findLastOpaque(row, minX, width, alphaMask);
+      break;
+    }
+  }
+
+  if (minY == height) {
+    *left = 0;
+    *top = 0;
+    *right = 1;
+    *bottom = 1;
+    return false;
+  }
+
+  /* First row from the bottom with an opaque pixel */
+  for (; maxY > minY; maxY--) {
+    const uint32_t *row = getRow(pixels, pitch, maxY);
+    int first = findFirstOpaque(row, 0, width, alphaMask);
+    if (first < width) {
+      if (first < minX) {
+        minX = first;
+      }
+      int last = findLastOpaque(row, first, width, alphaMask);
+      if (last > maxX) {
+        maxX = last;
+      }
+      break;
+    }
+  }
+
+  /*
+   * The rows in between can only widen the box, so only the parts
+   * outside the box found so far need to be looked at.
+   */
+  for (int y = minY + 1; y < maxY; y++) {
+    const uint32_t *row = getRow(pixels, pitch, y);
+    minX = findFirstOpaque(row, 0, minX, alphaMask);
+    maxX = findLastOpaque(row, maxX, width, alphaMask);
+  }
+
+  *left = minX;
+  *top = minY;
+  *right = maxX;
+  *bottom = maxY + 1;
+  return true;
+}
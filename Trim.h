@@ -0,0 +1,23 @@
+#ifndef _TRIM_H_
+#define _TRIM_H_
+
+#include <stdint.h>
+
+class Trim {
+
+public:
+  /*
+   * findOpaqueArea()
+   *
+   * Find the bounding box of the pixels with a non-zero alpha in a 32 bit
+   * image. pitch is in bytes, alphaMask selects the alpha bits of a pixel.
+   * The box is returned as left/top (inclusive) and right/bottom
+   * (exclusive). Returns false, and a 1x1 box at 0,0, if every pixel is
+   * fully transparent.
+   */
+  static bool findOpaqueArea(const uint32_t *pixels, int pitch, int width,
+                             int height, uint32_t alphaMask, int *left,
+                             int *top, int *right, int *bottom);
+};
+
+#endif
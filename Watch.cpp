@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "Watch.h"
+
+Watch::Watch()
+{
+  mFd = -1;
+}
+
+Watch::~Watch()
+{
+  if (mFd >= 0) {
+    close(mFd);
+  }
+}
+
+int Watch::open(const char *dir)
+{
+  mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mFd < 0) {
+    return -1;
+  }
+
+  /*
+   * Files are looked at once they are closed after writing, or moved in
+   * whole (editors saving through a temporary file)
+   */
+  uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+                  IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+  if (inotify_add_watch(mFd, dir, mask) < 0) {
+    int savedErrno = errno;
+    close(mFd);
+    mFd = -1;
+    errno = savedErrno;
+    return -1;
+  }
+  return 0;
+}
+
+static void addFileName(std::vector<std::string> *fileNames,
+                        const std::string &fileName)
+{
+  if (std::find(fileNames->begin(), fileNames->end(), fileName) ==
+      fileNames->end()) {
+    fileNames->push_back(fileName);
+  }
+}
+
+int Watch::wait(int settleMs, std::vector<std::string> *fileNames)
+{
+  char buf[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+
+  for (;;) {
+    struct pollfd pfd;
+    pfd.fd = mFd;
+    pfd.events = POLLIN;
+
+    /* Wait as long as it takes for the first change only */
+    int ready = poll(&pfd, 1, changed ? settleMs : -1);
+    if (ready < 0) {
+      return -1;
+    }
+    if (ready == 0) {
+      return 0;
+    }
+
+    ssize_t len = read(mFd, buf, sizeof(buf));
+    if (len < 0) {
+      if (errno == EAGAIN) {
+        continue;
+      }
+      return -1;
+    }
+
+    char *p = buf;
+    while (p < buf + len) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        return 1;
+      }
+      if (event->mask & IN_Q_OVERFLOW) {
+        addFileName(fileNames, "");
+      } else if (event->len > 0) {
+        addFileName(fileNames, event->name);
+      }
+      changed = true;
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include <string>
+#include <vector>
+
+/*
+ * Waits for files in a directory to be written, added or removed (inotify)
+ */
+class Watch {
+
+public:
+  Watch();
+  ~Watch();
+
+  /*
+   * open()
+   *
+   * Start watching a directory, not its subdirectories.
+   * Returns 0 on success, else error (see errno).
+   */
+  int open(const char *dir);
+
+  /*
+   * wait()
+   *
+   * Block until files in the directory change, then keep collecting
+   * changes until none come for settleMs, so a batch of saves is handled
+   * at once. The names of the files that changed are added to fileNames,
+   * each once. An empty name means events were lost and any file may have
+   * changed.
+   *
+   * Returns 0 on changes, 1 if the directory was removed or moved away and
+   * -1 on error or when interrupted by a signal (errno EINTR).
+   */
+  int wait(int settleMs, std::vector<std::string> *fileNames);
+
+private:
+  int mFd;
+};
+
+#endif
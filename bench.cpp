@@ -0,0 +1,614 @@
+#include <algorithm>
+#include <argtable2.h>
+#include <math.h>
+#include <set>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "Allocator.h"
+#include "Atlas.h"
+#include "Packer.h"
+#include "Search.h"
+
+/*
+ * Packing benchmark
+ *
+ * Generates synthetic sprite sets from a seed, searches the atlas size for
+ * each of them like the textureatlas tool does and then times tryCreate()
+ * at the chosen size. The same seed always gives the same sprites, so runs
+ * of different builds can be compared.
+ *
+ * With --trace, allocation traces of runtime caches are replayed on the
+ * Atlas::Allocator instead.
+ */
+
+/* Largest atlas dimension to try */
+#ifndef MAX_ATLAS_SIZE
+#define MAX_ATLAS_SIZE 8192
+#endif
+
+/*
+ * Small portable random number generator (xorshift64*), the sprite sets
+ * must not depend on the C library's rand()
+ */
+class Random {
+public:
+  Random(uint64_t seed)
+  {
+    /* Spread the seed bits with a splitmix64 step, never all zeros */
+    seed += 0x9e3779b97f4a7c15ull;
+    seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ull;
+    seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebull;
+    mState = (seed ^ (seed >> 31)) | 1;
+  }
+
+  uint64_t next()
+  {
+    mState ^= mState >> 12;
+    mState ^= mState << 25;
+    mState ^= mState >> 27;
+    return mState * 0x2545f4914f6cdd1dull;
+  }
+
+  /* Uniform in [0, 1) */
+  double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+  /* Uniform in [low, high] */
+  int range(int low, int high)
+  {
+    return low + (int)(next() % (uint64_t)(high - low + 1));
+  }
+
+private:
+  uint64_t mState;
+};
+
+static void generateUniform(Random *random, int count,
+                            std::vector<Atlas::NodeRect> *rects)
+{
+  for (int i = 0; i < count; i++) {
+    rects->push_back(
+        Atlas::NodeRect(random->range(8, 128), random->range(8, 128)));
+  }
+}
+
+/*
+ * Pareto distributed sizes: mostly small sprites with a long tail of large
+ * ones, as in typical game art
+ */
+static void generatePowerLaw(Random *random, int count,
+                             std::vector<Atlas::NodeRect> *rects)
+{
+  const double minSize = 8.0;
+  const double alpha = 1.5;
+  for (int i = 0; i < count; i++) {
+    double size = minSize / pow(1.0 - random->uniform(), 1.0 / alpha);
+    double aspect = 0.5 + 1.5 * random->uniform();
+    int w = (int)std::min(size * aspect, 512.0);
+    int h = (int)std::min(size / aspect, 512.0);
+    rects->push_back(Atlas::NodeRect(std::max(w, 1), std::max(h, 1)));
+  }
+}
+
+/* Many tiny font glyphs, narrow and of a few line heights */
+static void generateGlyphs(Random *random, int count,
+                           std::vector<Atlas::NodeRect> *rects)
+{
+  for (int i = 0; i < count * 4; i++) {
+    rects->push_back(
+        Atlas::NodeRect(random->range(3, 16), 10 + 4 * random->range(0, 3)));
+  }
+}
+
+/* A few huge backgrounds with a handful of props */
+static void generateBackgrounds(Random *random, int count,
+                                std::vector<Atlas::NodeRect> *rects)
+{
+  int numBackgrounds = std::max(2, count / 250);
+  for (int i = 0; i < numBackgrounds; i++) {
+    rects->push_back(Atlas::NodeRect(random->range(640, 2048),
+                                     random->range(480, 1536)));
+  }
+  for (int i = 0; i < numBackgrounds * 4; i++) {
+    rects->push_back(
+        Atlas::NodeRect(random->range(32, 256), random->range(32, 256)));
+  }
+}
+
+static const struct {
+  const char *name;
+  void (*generate)(Random *random, int count,
+                   std::vector<Atlas::NodeRect> *rects);
+} distributions[] = {
+    {"uniform", generateUniform},
+    {"power-law", generatePowerLaw},
+    {"glyphs", generateGlyphs},
+    {"backgrounds", generateBackgrounds},
+};
+
+#define NUM_DISTRIBUTIONS (sizeof(distributions) / sizeof(distributions[0]))
+
+/*
+ * Search the atlas size for one sprite set and time the packer at that
+ * size. Prints one line of results.
+ */
+static void runBench(const char *distribution,
+                     std::vector<Atlas::NodeRect> &rects,
+                     Search::Options *options, Search::Order order,
+                     int repeat)
+{
+  std::vector<Atlas::NodeRect *> rectList;
+  for (size_t i = 0; i < rects.size(); i++) {
+    rectList.push_back(&rects[i]);
+  }
+  Search::sortRects(rectList, order);
+
+  printf("%-12s %-14s %7d ", distribution,
+         Atlas::Packer::getTypeName(options->packer), (int)rects.size());
+
+  Search::Result result;
+  if (!Search::findBestFit(rectList, options, &result)) {
+    printf("does not fit in %d x %d\n", options->maxSize, options->maxSize);
+    return;
+  }
+
+  Atlas::Packer *packer = Atlas::Packer::create(options->packer);
+  packer->setAllowRotate(options->allowRotate);
+  packer->setSplitRule(options->splitRule);
+
+  Atlas::NodeRect *failedRect;
+  int failedAt;
+  double startTime = Search::getTimeMs();
+  for (int i = 0; i < repeat; i++) {
+    Search::tryCreate(result.width, result.height, rectList, packer,
+                      &failedRect, &failedAt);
+  }
+  double insertTime = Search::getTimeMs() - startTime;
+
+  double occupancy = 100.0 * (double)result.numPixels /
+                     ((double)result.width * result.height);
+  double spritesPerSec = insertTime > 0.0 ? 1000.0 * rects.size() * repeat /
+                                                insertTime
+                                          : 0.0;
+
+  printf("%5d x %-5d %6.1f%% %8d %5d/%-5d %9.1f %12.0f\n", result.width,
+         result.height, occupancy, packer->getNumNodes(), result.numTried,
+         result.numDimensions, result.packTime, spritesPerSec);
+
+  delete packer;
+}
+
+/*
+ * Runtime allocator traces: entries of a cache are allocated and freed in
+ * the atlas as the cache changes, an operation with no size frees its
+ * entry
+ */
+struct TraceOp {
+  int key;
+  int width, height;
+};
+
+/* Part of the atlas area a cache fills before it evicts */
+#define TRACE_BUDGET 0.8
+
+/*
+ * Glyph cache: glyphs of a few font sizes requested with Zipf distributed
+ * popularity, the least recently used ones evicted to stay in budget
+ */
+static void generateGlyphCache(Random *random, int count, int atlasSize,
+                               std::vector<TraceOp> *ops)
+{
+  static const int fontSizes[] = {12, 16, 16, 24, 24, 32, 48};
+  int numGlyphs = count * 2;
+  int numRequests = count * 25;
+  long long budget = (long long)(TRACE_BUDGET * atlasSize * atlasSize);
+
+  std::vector<int> widths(numGlyphs), heights(numGlyphs);
+  std::vector<double> cdf(numGlyphs);
+  double sum = 0.0;
+  for (int i = 0; i < numGlyphs; i++) {
+    int size = fontSizes[random->range(0, 6)];
+    widths[i] = random->range(size / 3, size);
+    heights[i] = random->range(size / 2, size + size / 4);
+    sum += 1.0 / (i + 1);
+    cdf[i] = sum;
+  }
+
+  /* Last use of each cached glyph, oldest first */
+  std::set<std::pair<int, int> > lru;
+  std::vector<int> lastUse(numGlyphs, -1);
+  long long cachedArea = 0;
+
+  for (int t = 0; t < numRequests; t++) {
+    int key = std::lower_bound(cdf.begin(), cdf.end(),
+                               random->uniform() * sum) -
+              cdf.begin();
+    key = std::min(key, numGlyphs - 1);
+
+    if (lastUse[key] >= 0) {
+      lru.erase(std::make_pair(lastUse[key], key));
+    } else {
+      long long area = (long long)widths[key] * heights[key];
+      while (cachedArea + area > budget && !lru.empty()) {
+        int evicted = lru.begin()->second;
+        lru.erase(lru.begin());
+        lastUse[evicted] = -1;
+        cachedArea -= (long long)widths[evicted] * heights[evicted];
+        TraceOp op = {evicted, 0, 0};
+        ops->push_back(op);
+      }
+      cachedArea += area;
+      TraceOp op = {key, widths[key], heights[key]};
+      ops->push_back(op);
+    }
+    lastUse[key] = t;
+    lru.insert(std::make_pair(t, key));
+  }
+}
+
+/*
+ * Entries of random sizes that come and go, freed at random, new ones
+ * once in a while freeing first to stay in budget
+ */
+static void generateChurn(Random *random, int count, int atlasSize,
+                          const int (*sizes)[2], int numSizes,
+                          std::vector<TraceOp> *ops)
+{
+  long long budget = (long long)(TRACE_BUDGET * atlasSize * atlasSize);
+  std::vector<TraceOp> live;
+  long long liveArea = 0;
+  int nextKey = 0;
+
+  for (int t = 0; t < count * 10; t++) {
+    TraceOp op;
+    op.key = nextKey;
+    if (sizes) {
+      int size = random->range(0, numSizes - 1);
+      op.width = sizes[size][0];
+      op.height = sizes[size][1];
+    } else {
+      op.width = random->range(8, 128);
+      op.height = random->range(8, 128);
+    }
+    long long area = (long long)op.width * op.height;
+
+    while (!live.empty() && (liveArea + area > budget ||
+                             random->uniform() < 0.45)) {
+      int index = random->range(0, live.size() - 1);
+      TraceOp freed = {live[index].key, 0, 0};
+      ops->push_back(freed);
+      liveArea -= (long long)live[index].width * live[index].height;
+      live[index] = live.back();
+      live.pop_back();
+    }
+
+    ops->push_back(op);
+    live.push_back(op);
+    liveArea += area;
+    nextKey++;
+  }
+}
+
+static void generateThumbnails(Random *random, int count, int atlasSize,
+                               std::vector<TraceOp> *ops)
+{
+  static const int sizes[][2] = {
+      {64, 64}, {96, 96}, {128, 128}, {128, 72},
+      {160, 90}, {256, 144}, {192, 108},
+  };
+  generateChurn(random, count, atlasSize, sizes, 7, ops);
+}
+
+static void generateMixed(Random *random, int count, int atlasSize,
+                          std::vector<TraceOp> *ops)
+{
+  generateChurn(random, count, atlasSize, NULL, 0, ops);
+}
+
+static const struct {
+  const char *name;
+  void (*generate)(Random *random, int count, int atlasSize,
+                   std::vector<TraceOp> *ops);
+} traces[] = {
+    {"glyph-cache", generateGlyphCache},
+    {"thumbnails", generateThumbnails},
+    {"mixed", generateMixed},
+};
+
+#define NUM_TRACES (sizeof(traces) / sizeof(traces[0]))
+
+/*
+ * Replay a trace on the runtime allocator. An allocation that fails is
+ * tried again after defragmenting, and counted as failed if it still does
+ * not fit. Prints one line of results.
+ */
+static void runTrace(const char *trace, std::vector<TraceOp> &ops,
+                     int atlasSize, int repeat)
+{
+  int numKeys = 0;
+  for (size_t i = 0; i < ops.size(); i++) {
+    numKeys = std::max(numKeys, ops[i].key + 1);
+  }
+
+  int numFailed = 0, numDefrags = 0;
+  long long numMoved = 0;
+  double fragmentation = 0.0;
+  int numSamples = 0;
+  double replayTime = 0.0;
+  Atlas::Allocator::Usage usage;
+
+  for (int r = 0; r < repeat; r++) {
+    Atlas::Allocator allocator, compacted;
+    std::vector<Atlas::Allocator::Move> moves;
+    std::vector<int> ids(numKeys, -1);
+    allocator.reset(atlasSize, atlasSize);
+    numFailed = numDefrags = 0;
+    numMoved = 0;
+
+    /* Fragmentation is sampled outside the timed parts */
+    double startTime = Search::getTimeMs();
+    for (size_t i = 0; i < ops.size(); i++) {
+      TraceOp *op = &ops[i];
+      if (op->width == 0) {
+        allocator.free(ids[op->key]);
+        ids[op->key] = -1;
+        continue;
+      }
+
+      ids[op->key] = allocator.allocate(op->width, op->height);
+      if (ids[op->key] < 0) {
+        if (allocator.planDefragment(&compacted, &moves)) {
+          std::swap(allocator, compacted);
+          numDefrags++;
+          numMoved += moves.size();
+          ids[op->key] = allocator.allocate(op->width, op->height);
+        }
+        if (ids[op->key] < 0) {
+          numFailed++;
+        }
+      }
+
+      if (r == 0 && i % 1024 == 0) {
+        replayTime += Search::getTimeMs() - startTime;
+        allocator.getUsage(&usage);
+        fragmentation += usage.fragmentation;
+        numSamples++;
+        startTime = Search::getTimeMs();
+      }
+    }
+    replayTime += Search::getTimeMs() - startTime;
+    allocator.getUsage(&usage);
+  }
+
+  printf("%-12s %8d %7d %7d %8lld %6.1f%% %6.1f%% %7d %9.1f\n", trace,
+         (int)ops.size(), numFailed, numDefrags, numMoved,
+         numSamples ? 100.0 * fragmentation / numSamples : 0.0,
+         100.0 * usage.fragmentation, usage.numFreeRects,
+         1000000.0 * replayTime / ((double)ops.size() * repeat));
+}
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+
+  struct arg_lit *help;
+  struct arg_int *seed;
+  struct arg_int *count;
+  struct arg_str *distribution;
+  struct arg_str *packer;
+  struct arg_str *search;
+  struct arg_str *order;
+  struct arg_str *split;
+  struct arg_lit *allowRotate;
+  struct arg_lit *npot;
+  struct arg_int *jobs;
+  struct arg_int *repeat;
+  struct arg_str *trace;
+  struct arg_int *atlasSize;
+  struct arg_end *end;
+
+  void *argtable[] = {
+      help = arg_lit0("h", "help", "Display this help text."),
+      seed = arg_int0("s", "seed", "N",
+                      "Seed of the sprite sets (default 1)."),
+      count = arg_int0("n", "count", "N",
+                       "Sprites in a set (default 2000, glyph sets have 4 "
+                       "times as many, background sets far fewer)."),
+      distribution = arg_str0("d", "distribution",
+                              "uniform|power-law|glyphs|backgrounds",
+                              "Sprite set to run (default all)."),
+      packer = arg_str0(NULL, "packer",
+                        "guillotine|maxrects-bssf|maxrects-baf|skyline",
+                        "Packing engine to run (default all)."),
+      search = arg_str0(NULL, "search", "exhaustive|pruned|bisect",
+                        "How to search for the atlas dimension (default "
+                        "pruned)."),
+      order = arg_str0(NULL, "order",
+                       "width|height|area|max-side|perimeter",
+                       "Order to pack the sprites in, largest first "
+                       "(default width, as the textureatlas tool)."),
+      split = arg_str0(NULL, "split", "larger|smaller",
+                       "Leftover the guillotine packer keeps whole when it "
+                       "splits free space (default larger)."),
+      allowRotate = arg_lit0(NULL, "allow-rotate",
+                             "Let the packer turn sprites 90 degrees."),
+      npot = arg_lit0(NULL, "npot",
+                      "Allow any atlas size, not only powers of two."),
+      jobs = arg_int0("j", "jobs", "N",
+                      "Number of threads to search with (0 for one per CPU "
+                      "core, default 1)."),
+      repeat = arg_int0("r", "repeat", "N",
+                        "Times to pack each set at the chosen size when "
+                        "timing the packer (default 3)."),
+      trace = arg_str0(NULL, "trace", "glyph-cache|thumbnails|mixed|all",
+                       "Replay allocations and frees of a runtime cache on "
+                       "the dynamic allocator instead of packing sprite "
+                       "sets."),
+      atlasSize = arg_int0(NULL, "atlas-size", "N",
+                           "Size of the atlas traces are replayed in "
+                           "(default 1024)."),
+      end = arg_end(20),
+  };
+
+  err = arg_parse(argc, argv, argtable);
+
+  if (help->count) {
+    fprintf(stdout, "Usage: %s", argv[0]);
+    arg_print_syntax(stdout, argtable, "\n");
+    fprintf(stdout, "Options:\n");
+    arg_print_glossary_gnu(stdout, argtable);
+    return 0;
+  } else if (err > 0) {
+    arg_print_errors(stdout, end, argv[0]);
+    fprintf(stdout, "Usage: %s", argv[0]);
+    arg_print_syntax(stdout, argtable, "\n");
+    return -1;
+  }
+
+  Search::Options options;
+  options.strategy = Search::StrategyPruned;
+  options.packer = Atlas::PackerGuillotine;
+  options.splitRule = Atlas::SplitLargerLeftover;
+  options.timeBudget = 0;
+  options.allowRotate = allowRotate->count > 0;
+  options.npot = npot->count > 0;
+  options.align = 1;
+  options.maxSize = MAX_ATLAS_SIZE;
+  options.jobs = jobs->count > 0 ? jobs->ival[0] : 1;
+  options.verbose = false;
+
+  unsigned int benchSeed = seed->count > 0 ? seed->ival[0] : 1;
+  int benchCount = count->count > 0 ? count->ival[0] : 2000;
+  int benchRepeat = repeat->count > 0 ? repeat->ival[0] : 3;
+
+  int traceAtlasSize = atlasSize->count > 0 ? atlasSize->ival[0] : 1024;
+
+  if (benchCount < 1 || benchRepeat < 1) {
+    printf("Invalid sprite count or repeat count\n");
+    err = -1;
+  }
+
+  if (traceAtlasSize < 1 || traceAtlasSize > MAX_ATLAS_SIZE) {
+    printf("Invalid atlas size %d\n", traceAtlasSize);
+    err = -1;
+  }
+
+  if (trace->count > 0 && strcmp(trace->sval[0], "all") != 0) {
+    unsigned int i = 0;
+    while (i < NUM_TRACES && strcmp(trace->sval[0], traces[i].name) != 0) {
+      i++;
+    }
+    if (i == NUM_TRACES) {
+      printf("Unknown trace %s\n", trace->sval[0]);
+      err = -1;
+    }
+  }
+
+  if (search->count > 0) {
+    if (strcmp(search->sval[0], "exhaustive") == 0) {
+      options.strategy = Search::StrategyExhaustive;
+    } else if (strcmp(search->sval[0], "pruned") == 0) {
+      options.strategy = Search::StrategyPruned;
+    } else if (strcmp(search->sval[0], "bisect") == 0) {
+      options.strategy = Search::StrategyBisect;
+    } else {
+      printf("Unknown search strategy %s\n", search->sval[0]);
+      err = -1;
+    }
+  }
+
+  Search::Order benchOrder = Search::OrderWidth;
+  if (order->count > 0) {
+    int type = Search::getOrderByName(order->sval[0]);
+    if (type < 0) {
+      printf("Unknown order %s\n", order->sval[0]);
+      err = -1;
+    } else {
+      benchOrder = (Search::Order)type;
+    }
+  }
+
+  if (split->count > 0) {
+    if (strcmp(split->sval[0], "larger") == 0) {
+      options.splitRule = Atlas::SplitLargerLeftover;
+    } else if (strcmp(split->sval[0], "smaller") == 0) {
+      options.splitRule = Atlas::SplitSmallerLeftover;
+    } else {
+      printf("Unknown split rule %s\n", split->sval[0]);
+      err = -1;
+    }
+  }
+
+  int firstPacker = Atlas::PackerGuillotine;
+  int lastPacker = Atlas::PackerSkyline;
+  if (packer->count > 0) {
+    firstPacker = lastPacker = Atlas::Packer::getTypeByName(packer->sval[0]);
+    if (firstPacker < 0) {
+      printf("Unknown packer %s\n", packer->sval[0]);
+      err = -1;
+    }
+  }
+
+  if (distribution->count > 0) {
+    unsigned int i = 0;
+    while (i < NUM_DISTRIBUTIONS &&
+           strcmp(distribution->sval[0], distributions[i].name) != 0) {
+      i++;
+    }
+    if (i == NUM_DISTRIBUTIONS) {
+      printf("Unknown distribution %s\n", distribution->sval[0]);
+      err = -1;
+    }
+  }
+
+  if (err) {
+    return err;
+  }
+
+  if (trace->count > 0) {
+    printf("Generating traces with seed %u, atlas %d x %d\n", benchSeed,
+           traceAtlasSize, traceAtlasSize);
+    printf("%-12s %8s %7s %7s %8s %7s %7s %7s %9s\n", "trace", "ops",
+           "failed", "defrags", "moved", "frag", "end", "free", "ns/op");
+
+    for (unsigned int i = 0; i < NUM_TRACES; i++) {
+      if (strcmp(trace->sval[0], "all") != 0 &&
+          strcmp(trace->sval[0], traces[i].name) != 0) {
+        continue;
+      }
+
+      Random random(((uint64_t)benchSeed << 8) | (0x80 + i));
+      std::vector<TraceOp> ops;
+      traces[i].generate(&random, benchCount, traceAtlasSize, &ops);
+      runTrace(traces[i].name, ops, traceAtlasSize, benchRepeat);
+    }
+    return 0;
+  }
+
+  printf("Generating sprites with seed %u\n", benchSeed);
+  printf("%-12s %-14s %7s %13s %7s %8s %11s %9s %12s\n", "distribution",
+         "packer", "sprites", "dimension", "occup.", "nodes", "tried",
+         "search ms", "sprites/sec");
+
+  for (unsigned int i = 0; i < NUM_DISTRIBUTIONS; i++) {
+    if (distribution->count > 0 &&
+        strcmp(distribution->sval[0], distributions[i].name) != 0) {
+      continue;
+    }
+
+    /* Each set has its own stream, whatever else is run */
+    Random random(((uint64_t)benchSeed << 8) | i);
+    std::vector<Atlas::NodeRect> rects;
+    distributions[i].generate(&random, benchCount, &rects);
+
+    for (int p = firstPacker; p <= lastPacker; p++) {
+      options.packer = (Atlas::PackerType)p;
+      runBench(distributions[i].name, rects, &options, benchOrder,
+               benchRepeat);
+    }
+  }
+
+  return 0;
+}
@@ -1,19 +1,55 @@
+#include <algorithm>
 #include <argtable2.h>
+#include <dirent.h>
 #include <errno.h>
-#include <list>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unordered_map>
+#include <vector>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
-#include "Atlas.h"
+#include "Bytes.h"
+#include "Cache.h"
+#include "Compress.h"
+#include "Convert.h"
+#include "Mip.h"
+#include "NamePool.h"
+#include "Packer.h"
+#include "Parallel.h"
+#include "Search.h"
+#include "Stats.h"
+#include "TextureAtlas.h"
+#include "TextureFile.h"
+#include "Watch.h"
 #include "savepng.h"
 
+/* Binary sprite map layout */
+#include "res/SpriteDescriptor.h"
+
 #define USE_CFILE
 
+/* Largest atlas dimension to try */
+#ifndef MAX_ATLAS_SIZE
+#define MAX_ATLAS_SIZE 8192
+#endif
+
+/*
+ * Most image file arguments, more than a command line holds. Longer lists
+ * are given as @file.
+ */
+#define MAX_INPUT_ARGS 200000
+
+/* Widest border --extrude takes */
+#define MAX_EXTRUDE 64
+
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
 const uint32_t rmask = 0xff000000;
 const uint32_t gmask = 0x00ff0000;
@@ -33,6 +69,8 @@ extern char _binary_res_SpriteDescriptor_h_end;
   "  {\n"                                                                      \
   "    .offset = %d,\n"                                                        \
   "    .name = \"%s\",\n"                                                      \
+  "    .nameHash = 0x%08xu,\n"                                                 \
+  "    .page = %d,\n"                                                          \
   "\n"                                                                         \
   "    /* Integer coordinates (Pixel position) */\n"                           \
   "    .left = %d,\n"                                                          \
@@ -41,66 +79,62 @@ extern char _binary_res_SpriteDescriptor_h_end;
   "    .bottom = %d,\n"                                                        \
   "    .width = %d,\n"                                                         \
   "    .height = %d,\n"                                                        \
+  "    .rotated = %d,\n"                                                       \
+  "\n"                                                                         \
+  "    /* Area of the original image file the sprite was trimmed to */\n"      \
+  "    .trimLeft = %d,\n"                                                      \
+  "    .trimTop = %d,\n"                                                       \
+  "    .sourceWidth = %d,\n"                                                   \
+  "    .sourceHeight = %d,\n"                                                  \
   "  },\n"
 
 #define SPRITE_DESC_FMT_HFILE "static " SPRITE_DESC_FMT_CFILE
 
 /*
- * Image atlas node
+ * One page (image file) of the atlas
  */
-class Image : public Atlas::NodeRect {
-public:
-  Image(const char *name, SDL_Surface *surface)
-      : NodeRect(surface->w, surface->h)
-  {
-    mSurface = surface;
-    strcpy(mName, name);
-  }
-
-  SDL_Surface *getSurface() { return mSurface; }
-
-  /* Used when sorting image list at size */
-  static bool compare(Image *img1, Image *img2)
-  {
-    if (img1->getWidth() == img2->getWidth()) {
-      return (img1->getHeight() > img2->getHeight());
-    } else {
-      return (img1->getWidth() > img2->getWidth());
-    }
-  }
+struct AtlasPage {
+  char imageFileName[520];
+  int err;
 
-  const char *getName() { return mName; }
-
-private:
-  SDL_Surface *mSurface;
-  char mName[512];
+  /* Time spent drawing and encoding the page, in milliseconds */
+  double drawTime, encodeTime;
 };
 
 /*
- * Draw a nodes surface to the atlas surface
+ * Options given on the command line
  */
-static void drawNode(int level, Atlas::Node *node, void *param)
-{
-  SDL_Surface *surface = (SDL_Surface *)param;
-  SDL_Rect rect;
-  Image *image = (Image *)node->getRect();
-  rect.x = node->getLeft();
-  rect.y = node->getTop();
-  rect.w = node->getWidth();
-  rect.h = node->getHeight();
-
-  SDL_BlitSurface(image->getSurface(), NULL, surface, &rect);
-}
-
-class Dimension {
-public:
-  Dimension(int w, int h)
-  {
-    mWidth = w;
-    mHeight = h;
-  }
-
-  int mWidth, mHeight;
+struct Options {
+  int jobs;
+  Search::Strategy search;
+  Atlas::PackerType packer;
+  int timeBudget;
+  bool allowRotate;
+  bool npot;
+  int align;
+  bool trim;
+  bool dedup;
+  int extrude;
+  bool mips;
+  bool cache;
+  PNG::Options png;
+  bool compress;
+  Compress::Format format;
+  Convert::Format pixelFormat;
+  Convert::Dither dither;
+  bool premultiply;
+  bool raw;
+  bool binary;
+  bool quiet;
+  const char *statsFileName; /* NULL for none */
+  const char *watchDir;      /* NULL unless watching a directory */
+
+  /* Image files, as given and without the directory part */
+  std::vector<const char *> files;
+  std::vector<const char *> fileNames;
+
+  /* Image files read from lists and directories, and sprite names */
+  NamePool names;
 };
 
 enum OutFmt {
@@ -112,8 +146,11 @@ struct OutputParams {
   enum OutFmt fmt;
   int numSprites;
   int indexOffset;
-  Dimension *dimension;
-  const char *imageFileName;
+  std::vector<CacheManifest::Page> *pages;
+
+  /* Minimal perfect hash of the sprite names, empty if none */
+  std::vector<int> hashDisplacements;
+  std::vector<unsigned int> hashSlots;
 #ifdef USE_CFILE
   FILE *cFile;
 #endif
@@ -148,18 +185,65 @@ static int add_file_headers(struct OutputParams *outputParams,
           "extern const struct SpriteMapDescriptor %s;\n",
           tmpStr, tmpStr, atlasName);
 #ifdef USE_CFILE
+  std::vector<CacheManifest::Page> &pages = *outputParams->pages;
+
   fprintf(outputParams->cFile,
           "#include \"SpriteDescriptor.h\"\n"
           "#include \"%s.h\"\n\n"
+          "static const struct SpritePageDescriptor %s_pages[] = {\n",
+          atlasName, atlasName);
+  for (size_t i = 0; i < pages.size(); i++) {
+    fprintf(outputParams->cFile,
+            "  {\n"
+            "    .imageFileName = \"%s\",\n"
+            "    .width = %d,\n"
+            "    .height = %d,\n"
+            "  },\n",
+            pages[i].imageFileName.c_str(), pages[i].width, pages[i].height);
+  }
+  fprintf(outputParams->cFile, "};\n\n");
+
+  std::vector<int> &displacements = outputParams->hashDisplacements;
+  std::vector<unsigned int> &slots = outputParams->hashSlots;
+  if (!displacements.empty()) {
+    fprintf(outputParams->cFile,
+            "static const int %s_hashDisplacements[] = {", atlasName);
+    for (size_t i = 0; i < displacements.size(); i++) {
+      fprintf(outputParams->cFile, "%s%d,", i % 8 ? " " : "\n  ",
+              displacements[i]);
+    }
+    fprintf(outputParams->cFile,
+            "\n};\n\n"
+            "static const unsigned int %s_hashSlots[] = {",
+            atlasName);
+    for (size_t i = 0; i < slots.size(); i++) {
+      fprintf(outputParams->cFile, "%s%u,", i % 8 ? " " : "\n  ", slots[i]);
+    }
+    fprintf(outputParams->cFile, "\n};\n\n");
+  }
+
+  fprintf(outputParams->cFile,
           "const struct SpriteMapDescriptor %s = {\n"
           "  .name = \"%s\",\n"
           "  .imageFileName = \"%s\",\n"
           "  .width = %d,\n"
           "  .height = %d,\n"
+          "  .numPages = %d,\n"
+          "  .pages = %s_pages,\n",
+          atlasName, atlasName, pages[0].imageFileName.c_str(), pages[0].width,
+          pages[0].height, (int)pages.size(), atlasName);
+  if (!displacements.empty()) {
+    fprintf(outputParams->cFile,
+            "  .numHashBuckets = %d,\n"
+            "  .hashDisplacements = %s_hashDisplacements,\n"
+            "  .numHashSlots = %d,\n"
+            "  .hashSlots = %s_hashSlots,\n",
+            (int)displacements.size(), atlasName, (int)slots.size(),
+            atlasName);
+  }
+  fprintf(outputParams->cFile,
           "  .numSprites = %d,\n"
           "  .sprites = {\n",
-          atlasName, atlasName, atlasName, outputParams->imageFileName,
-          outputParams->dimension->mWidth, outputParams->dimension->mHeight,
           outputParams->numSprites);
 #endif
 
@@ -190,85 +274,248 @@ static int add_file_footers(struct OutputParams *outputParams,
   return 0;
 }
 
-static void storeIndex(int level, Atlas::Node *node, void *param)
+static void storeSprite(SpriteRecord *sprite,
+                        struct OutputParams *outputParams)
 {
-  struct OutputParams *outputParams = (struct OutputParams *)param;
-  Image *image = (Image *)node->getRect();
-
-  //  printf("Storeing node %s...\n", image->getName());
-  int len = strlen(image->getName());
-  char tmpName[256];
-  const char *endOfName = strrchr(image->getName(), '.');
-  if (endOfName) {
-    len = endOfName - image->getName();
-  }
-
-  if (len >= sizeof(tmpName)) {
-    len = sizeof(tmpName) - 1;
-  }
-
-  memcpy(tmpName, image->getName(), len);
-  tmpName[len] = '\0';
-
 #ifdef USE_CFILE
   fprintf(outputParams->cFile, SPRITE_DESC_FMT_CFILE, outputParams->indexOffset,
-          tmpName, node->getLeft(), node->getTop(), node->getRight(),
-          node->getBottom(), node->getWidth(), node->getHeight());
+          sprite->name.c_str(), spritemap_hash_name(sprite->name.c_str(), 0),
+          sprite->page, sprite->left, sprite->top,
+          sprite->left + sprite->width, sprite->top + sprite->height,
+          sprite->width, sprite->height, sprite->rotated, sprite->trimLeft,
+          sprite->trimTop, sprite->sourceWidth, sprite->sourceHeight);
 #else
   fprintf(outputParams->hFile, SPRITE_DESC_FMT_HFILE, outputParams->indexOffset,
-          tmpName, node->getLeft(), node->getTop(), node->getRight(),
-          node->getBottom(), node->getWidth(), node->getHeight());
+          sprite->name.c_str(), spritemap_hash_name(sprite->name.c_str(), 0),
+          sprite->page, sprite->left, sprite->top,
+          sprite->left + sprite->width, sprite->top + sprite->height,
+          sprite->width, sprite->height, sprite->rotated, sprite->trimLeft,
+          sprite->trimTop, sprite->sourceWidth, sprite->sourceHeight);
 #endif
 
   outputParams->indexOffset++;
 }
 
+struct LoadParams {
+  struct Options *options;
+
+  /* Inputs to load, and the loaded surface of each */
+  std::vector<int> inputs;
+  std::vector<SDL_Surface *> surfaces;
+};
+
+static void loadImage(int index, int worker, void *param)
+{
+  struct LoadParams *params = (struct LoadParams *)param;
+  int input = params->inputs[index];
+
+  SDL_Surface *surface = IMG_Load(params->options->files[input]);
+
+  if (surface) {
+    /*
+     * Convert to the atlas format once, here on the loading threads. Pixels
+     * are then copied to the atlas as they are, and trimming and dedup can
+     * look at them directly.
+     */
+    SDL_Surface *converted = SDL_ConvertSurfaceFormat(
+        surface, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(surface);
+    surface = converted;
+  }
+
+  if (surface && params->options->premultiply) {
+    Convert::premultiply((uint32_t *)surface->pixels, surface->pitch,
+                         surface->w, surface->h);
+  }
+
+  params->surfaces[index] = surface;
+}
+
 /*
- * Try to fit images in the image list into a rectangle of the given dimension.
- *
- * Returns the atlas tree if successfully fitted all, else NULL.
+ * Length of the sprite name of an image file: the file name without its
+ * extension
  */
-static Atlas::Node *tryCreate(int w, int h, std::list<Image *> &imageList)
+static int getSpriteNameLength(const char *fileName)
 {
-  std::list<Image *>::iterator it;
-  Atlas::Node *root = new Atlas::Node(0, 0, w, h);
+  int len = strlen(fileName);
+  const char *endOfName = strrchr(fileName, '.');
+  if (endOfName) {
+    len = endOfName - fileName;
+  }
 
-  int i = 0;
-  for (it = imageList.begin(); it != imageList.end(); it++) {
-    Image *image = *it;
-    char *name = new char[20];
-    sprintf(name, "IMG %d", i++);
-    if (root->insert(image) == NULL) {
-
-      printf("Failed to insert image %d (w: %d, h: %d) in "
-             "surface (dimension w: %d, h: %d)\n",
-             i, image->getWidth(), image->getHeight(), w, h);
-
-      delete root;
-      root = NULL;
-      break;
-    }
+  if (len > 255) {
+    len = 255;
   }
 
-  return root;
+  return len;
+}
+
+static std::string getSpriteName(const char *fileName)
+{
+  return std::string(fileName, getSpriteNameLength(fileName));
+}
+
+/*
+ * Describe a loaded image as an input to pack
+ */
+static void setInput(TextureAtlas::Input *input, const char *name,
+                     SDL_Surface *surface)
+{
+  input->name = name;
+  input->width = surface->w;
+  input->height = surface->h;
+  input->pixels = (const uint32_t *)surface->pixels;
+  input->pitch = surface->pitch;
+}
+
+/*
+ * Get the modification time, size and content hash of an input file
+ */
+static void statInput(int index, int worker, void *param)
+{
+  CacheManifest *manifest = (CacheManifest *)param;
+  CacheManifest::Input *input = &manifest->inputs[index];
+
+  if (Cache::statInput(input->path.c_str(), &input->mtime, &input->size) ||
+      Cache::hashInput(input->path.c_str(), &input->hash)) {
+    input->mtime = -1;
+    input->size = -1;
+    input->hash = 0;
+  }
 }
 
-static int cmdLineParse(int argc, char *argv[], std::list<Image *> *imageList,
-                        char *atlasname)
+static int cmdLineParse(int argc, char *argv[], char *atlasname,
+                        struct Options *options)
 {
   int err = 0;
 
   struct arg_lit *help;
   struct arg_file *infile;
   struct arg_str *outname;
+  struct arg_int *jobs;
+  struct arg_str *search;
+  struct arg_str *packer;
+  struct arg_int *timeBudget;
+  struct arg_lit *allowRotate;
+  struct arg_lit *npot;
+  struct arg_int *align;
+  struct arg_lit *trim;
+  struct arg_lit *dedup;
+  struct arg_int *extrude;
+  struct arg_lit *mips;
+  struct arg_lit *noCache;
+  struct arg_int *pngLevel;
+  struct arg_str *pngFilter;
+  struct arg_lit *pngFast;
+  struct arg_str *texture;
+  struct arg_str *pixelFormat;
+  struct arg_str *dither;
+  struct arg_lit *premultiply;
+  struct arg_lit *raw;
+  struct arg_lit *binary;
+  struct arg_str *stats;
+  struct arg_lit *quiet;
+  struct arg_str *watch;
   struct arg_end *end;
 
   /* The command line arguments table */
   void *argtable[] = {
       help = arg_lit0("h", "help", "Display this help text."),
       outname = arg_str0("o", "out-format", "name", "Name of atlas to create."),
-      infile = arg_filen(NULL, NULL, "file", 1, 1000,
-                         "Image files to include in atlas."),
+      jobs = arg_int0("j", "jobs", "N",
+                      "Number of threads to use (0 for one per CPU core, "
+                      "default 1)."),
+      search = arg_str0(NULL, "search", "exhaustive|pruned|bisect",
+                        "How to search for the atlas dimension. 'pruned' "
+                        "(default) skips dimensions that cannot fit and "
+                        "stops at the first fit in order of waste, "
+                        "'bisect' binary searches the height for each "
+                        "width (faster, assumes a larger height always "
+                        "fits)."),
+      packer = arg_str0(NULL, "packer",
+                        "guillotine|maxrects-bssf|maxrects-baf|skyline",
+                        "Rectangle packing engine (default guillotine)."),
+      timeBudget = arg_int0(NULL, "time-budget", "MS",
+                            "Spend up to MS milliseconds packing the images "
+                            "in other orders (area, longest side, perimeter, "
+                            "height) and with other guillotine split rules, "
+                            "keeping the smallest atlas (default 0, width "
+                            "order only). How many are tried depends on the "
+                            "speed of the machine, so the atlas can differ "
+                            "from run to run."),
+      allowRotate = arg_lit0(NULL, "allow-rotate",
+                             "Let the packer turn images 90 degrees."),
+      npot = arg_lit0(NULL, "npot",
+                      "Allow any atlas size (not only powers of two) and "
+                      "crop the atlas to the area used."),
+      align = arg_int0(NULL, "align", "N",
+                       "With --npot, make the atlas size a multiple of N "
+                       "(e.g. 4 for block compressed formats, default 1)."),
+      trim = arg_lit0(NULL, "trim",
+                      "Trim fully transparent borders off the images."),
+      dedup = arg_lit0(NULL, "dedup",
+                       "Pack images with the same pixels only once."),
+      extrude = arg_int0(NULL, "extrude", "N",
+                         "Surround each image with a border of N pixels "
+                         "repeating its edge pixels, so filtering does not "
+                         "bleed neighbouring images in (0-64, default 0)."),
+      mips = arg_lit0(NULL, "mips",
+                      "Also write the mip levels of each page, down to 1x1: "
+                      "in the texture file with --texture, else as "
+                      "name_mipN.png files."),
+      noCache = arg_lit0(NULL, "no-cache",
+                         "Rebuild everything, even if the cache shows "
+                         "nothing or only a few images changed."),
+      pngLevel = arg_int0(NULL, "png-level", "0-9",
+                          "PNG compression level (default 6)."),
+      pngFilter = arg_str0(NULL, "png-filter",
+                           "adaptive|none|sub|up|average|paeth",
+                           "PNG row filter (default adaptive, the best "
+                           "filter for each row)."),
+      pngFast = arg_lit0(NULL, "png-fast",
+                         "Encode PNG files quickly at the cost of size, "
+                         "overrides --png-level and --png-filter."),
+      texture = arg_str0(NULL, "texture", "bc1|bc3|bc7|etc2",
+                         "Write GPU block compressed textures instead of "
+                         "PNG files: DDS for the BC formats, KTX2 for ETC2. "
+                         "Images are packed in whole 4x4 blocks."),
+      pixelFormat = arg_str0(NULL, "pixel-format",
+                             "rgba8888|rgba4444|rgb565|a8",
+                             "Write pages in an uncompressed format of fewer "
+                             "bits, as DDS files: 16 bits per pixel for "
+                             "rgba4444 and rgb565 (no alpha), 8 for a8 "
+                             "(alpha only). Default rgba8888, PNG files."),
+      dither = arg_str0(NULL, "dither", "none|ordered|diffusion",
+                        "Dithering of rgba4444 and rgb565 pages: none "
+                        "(nearest level, default), ordered (4x4 Bayer "
+                        "matrix) or diffusion (Floyd-Steinberg)."),
+      premultiply = arg_lit0(NULL, "premultiply",
+                             "Multiply the colors of the images by their "
+                             "alpha."),
+      raw = arg_lit0(NULL, "raw",
+                     "Write pages in the --pixel-format without a header "
+                     "(name.raw): rows, then mip levels, one after the "
+                     "other."),
+      binary = arg_lit0(NULL, "binary",
+                        "Also write the sprite index as a binary file "
+                        "(name.bin) to load at runtime with "
+                        "spritemap_bin_open()."),
+      stats = arg_str0(NULL, "stats", "file",
+                       "Write the time and CPU time of each phase, peak "
+                       "memory use, packing attempts and sizes of the "
+                       "files written as JSON to file."),
+      quiet = arg_lit0("q", "quiet",
+                       "Do not report the dimensions tried and other "
+                       "progress, only errors and the files written."),
+      watch = arg_str0(NULL, "watch", "DIR",
+                       "Pack the images in DIR, then keep running and update "
+                       "the atlas whenever images in DIR are written, added "
+                       "or removed. Only changed images are loaded again, "
+                       "and redrawn in place while they fit."),
+      infile = arg_filen(NULL, NULL, "file", 0, MAX_INPUT_ARGS,
+                         "Image files to include in atlas. A directory "
+                         "adds the images in it, @list adds the image "
+                         "files named in the file list, one per line."),
       end = arg_end(20),
   };
 
@@ -302,201 +549,1831 @@ static int cmdLineParse(int argc, char *argv[], std::list<Image *> *imageList,
       strcpy(atlasname, outname->sval[0]);
     }
 
+    if (jobs->count > 0) {
+      options->jobs = jobs->ival[0];
+    }
+
+    if (search->count > 0) {
+      if (strcmp(search->sval[0], "exhaustive") == 0) {
+        options->search = Search::StrategyExhaustive;
+      } else if (strcmp(search->sval[0], "pruned") == 0) {
+        options->search = Search::StrategyPruned;
+      } else if (strcmp(search->sval[0], "bisect") == 0) {
+        options->search = Search::StrategyBisect;
+      } else {
+        printf("Unknown search strategy %s\n", search->sval[0]);
+        err = -1;
+      }
+    }
+
+    if (packer->count > 0) {
+      int type = Atlas::Packer::getTypeByName(packer->sval[0]);
+      if (type < 0) {
+        printf("Unknown packer %s\n", packer->sval[0]);
+        err = -1;
+      } else {
+        options->packer = (Atlas::PackerType)type;
+      }
+    }
+
+    options->allowRotate = allowRotate->count > 0;
+    options->npot = npot->count > 0;
+    options->trim = trim->count > 0;
+    options->dedup = dedup->count > 0;
+    options->mips = mips->count > 0;
+    options->cache = noCache->count == 0;
+
     for (i = 0; i < infile->count; i++) {
-      SDL_Surface *surface = IMG_Load(infile->filename[i]);
-      SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
-      if (surface) {
-        imageList->push_back(new Image(infile->basename[i], surface));
+      options->files.push_back(infile->filename[i]);
+      options->fileNames.push_back(infile->basename[i]);
+    }
+
+    if (pngLevel->count > 0) {
+      if (pngLevel->ival[0] < 0 || pngLevel->ival[0] > 9) {
+        printf("Invalid PNG compression level %d\n", pngLevel->ival[0]);
+        err = -1;
       } else {
-        printf("Error loading image %s\n", infile->filename[i]);
+        options->png.level = pngLevel->ival[0];
+      }
+    }
+
+    if (pngFilter->count > 0) {
+      int filter = PNG::getFilterByName(pngFilter->sval[0]);
+      if (filter < 0) {
+        printf("Unknown PNG filter %s\n", pngFilter->sval[0]);
         err = -1;
-        break;
+      } else {
+        options->png.filter = (PNG::Filter)filter;
       }
     }
 
-    if (!err) {
-      imageList->sort(Image::compare);
+    options->png.fast = pngFast->count > 0;
+    options->png.jobs = options->jobs;
+    options->binary = binary->count > 0;
+    options->quiet = quiet->count > 0;
+    if (stats->count > 0) {
+      options->statsFileName = stats->sval[0];
+    }
+
+    if (watch->count > 0) {
+      if (infile->count > 0) {
+        printf("Image files can not be given with --watch, the images are "
+               "those in the directory\n");
+        err = -1;
+      } else {
+        options->watchDir = watch->sval[0];
+      }
+    } else if (infile->count == 0) {
+      printf("No image files given\n");
+      fprintf(stdout, "Usage: %s", argv[0]);
+      arg_print_syntax(stdout, argtable, "\n");
+      err = -1;
+    }
+
+    if (texture->count > 0) {
+      int format = Compress::getFormatByName(texture->sval[0]);
+      if (format < 0) {
+        printf("Unknown texture format %s\n", texture->sval[0]);
+        err = -1;
+      } else {
+        options->compress = true;
+        options->format = (Compress::Format)format;
+      }
+    }
+
+    if (pixelFormat->count > 0) {
+      int format = Convert::getFormatByName(pixelFormat->sval[0]);
+      if (format < 0) {
+        printf("Unknown pixel format %s\n", pixelFormat->sval[0]);
+        err = -1;
+      } else {
+        options->pixelFormat = (Convert::Format)format;
+      }
+    }
+
+    if (dither->count > 0) {
+      int type = Convert::getDitherByName(dither->sval[0]);
+      if (type < 0) {
+        printf("Unknown dithering %s\n", dither->sval[0]);
+        err = -1;
+      } else {
+        options->dither = (Convert::Dither)type;
+      }
+    }
+
+    options->premultiply = premultiply->count > 0;
+    options->raw = raw->count > 0;
+    if (options->compress &&
+        (options->raw || options->pixelFormat != Convert::FormatRGBA8888)) {
+      printf("--pixel-format and --raw can not be used with --texture\n");
+      err = -1;
+    }
+
+    if (align->count > 0) {
+      if (align->ival[0] < 1 || align->ival[0] > MAX_ATLAS_SIZE) {
+        printf("Invalid size alignment %d\n", align->ival[0]);
+        err = -1;
+      } else {
+        options->align = align->ival[0];
+      }
+    }
+
+    if (timeBudget->count > 0) {
+      if (timeBudget->ival[0] < 0) {
+        printf("Invalid time budget %d\n", timeBudget->ival[0]);
+        err = -1;
+      } else {
+        options->timeBudget = timeBudget->ival[0];
+      }
+    }
+
+    if (extrude->count > 0) {
+      if (extrude->ival[0] < 0 || extrude->ival[0] > MAX_EXTRUDE) {
+        printf("Invalid extrude border %d\n", extrude->ival[0]);
+        err = -1;
+      } else {
+        options->extrude = extrude->ival[0];
+      }
+    }
+
+    /* Pages must be made of whole blocks */
+    while (options->compress && options->align % 4 != 0) {
+      options->align *= 2;
     }
   }
 
   return err;
 }
 
-int main(int argc, char *argv[])
+/*
+ * Decode the image files given on the command line, one surface per file
+ */
+static int loadImages(struct Options *options,
+                      std::vector<SDL_Surface *> *surfaces)
 {
   int err = 0;
-  int numSprites = 0;
-  unsigned int seed = time(NULL);
-  //  seed = 1343398170;
-  printf("Generating images with seed %u\n", seed);
-  srand(seed);
+  int numFiles = options->files.size();
+
+  /*
+   * Decode the images in parallel, each into its own slot. The slots
+   * are then walked in command line order so errors are reported the
+   * same way whatever the scheduling.
+   */
+
+  struct LoadParams loadParams;
+  loadParams.options = options;
+  for (int i = 0; i < numFiles; i++) {
+    loadParams.inputs.push_back(i);
+  }
+  loadParams.surfaces.assign(numFiles, NULL);
+  Parallel::forEach(numFiles, options->jobs, loadImage, &loadParams);
 
-  std::list<Image *> imageList;
-  std::list<Image *>::iterator it;
-  std::list<Dimension *> resolutionList;
-  std::list<Dimension *>::iterator rit;
+  for (int i = 0; i < numFiles; i++) {
+    if (!loadParams.surfaces[i]) {
+      printf("Error loading image %s\n", options->files[i]);
+      err = -1;
+    }
+  }
 
-  /* Default atlas name */
-  char atlasname[512] = "unnamed_atlas";
+  surfaces->swap(loadParams.surfaces);
+  return err;
+}
 
-  err = cmdLineParse(argc, argv, &imageList, atlasname);
+/*
+ * Packing options of the library for the command line options
+ */
+static void getAtlasOptions(struct Options *options,
+                            TextureAtlas::Options *atlasOptions)
+{
+  TextureAtlas::getDefaultOptions(atlasOptions);
+  atlasOptions->search = options->search;
+  atlasOptions->packer = options->packer;
+  atlasOptions->allowRotate = options->allowRotate;
+  atlasOptions->npot = options->npot;
+  atlasOptions->align = options->align;
+  atlasOptions->trim = options->trim;
+  atlasOptions->dedup = options->dedup;
+  atlasOptions->extrude = options->extrude;
+  atlasOptions->maxSize = MAX_ATLAS_SIZE;
+  atlasOptions->jobs = options->jobs;
+  atlasOptions->verbose = !options->quiet;
+  atlasOptions->timeBudget = options->timeBudget;
+
+  /* Keep each image in blocks of its own */
+  if (options->compress) {
+    atlasOptions->pad = 4;
+  }
+}
 
-  if (!err) {
+/*
+ * Draw the images of a page and save it, in parallel with other pages
+ */
+struct WriteParams {
+  std::vector<AtlasPage> *pages;
+  std::vector<TextureAtlas::Input> *inputs;
+  TextureAtlas::Result *atlas;
+  int jobs; /* Threads for each page */
+  PNG::Options png;
+  bool compress;
+  Compress::Format format;
+  Convert::Format pixelFormat;
+  Convert::Dither dither;
+  bool raw;
+  bool mips;
+
+  /* Where to keep the drawn pages, NULL to free them once saved */
+  std::vector<SDL_Surface *> *surfaces;
+};
 
-    /*
-     * Generate surface resolutions
-     */
+/*
+ * Options of writing pages for the command line options, with jobs threads
+ * for each page
+ */
+static void setWriteOptions(struct WriteParams *params,
+                            struct Options *options, int jobs)
+{
+  params->jobs = jobs;
+  params->png = options->png;
+  params->png.jobs = jobs;
+  params->compress = options->compress;
+  params->format = options->format;
+  params->pixelFormat = options->pixelFormat;
+  params->dither = options->dither;
+  params->raw = options->raw;
+  params->mips = options->mips;
+}
+
+/*
+ * File name extension of the pages: the texture file of a block compressed
+ * format, raw, dds for the smaller pixel formats, else png
+ */
+static const char *getPageExtension(struct Options *options)
+{
+  if (options->compress) {
+    return TextureFile::getExtension(options->format);
+  }
+  if (options->raw) {
+    return "raw";
+  }
+  return options->pixelFormat != Convert::FormatRGBA8888 ? "dds" : "png";
+}
+
+/*
+ * File name of a mip level of a PNG page, name_mipN.png for name.png
+ */
+static std::string getMipFileName(const char *imageFileName, int level)
+{
+  std::string name = imageFileName;
+  size_t dot = name.rfind('.');
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "_mip%d", level);
+  return name.insert(dot == std::string::npos ? name.size() : dot, suffix);
+}
+
+/*
+ * Encode a drawn page to its file: a PNG file, a block compressed texture,
+ * or pixels in a smaller format, raw or as DDS. With mips, the levels below
+ * the page go in the same file, or a PNG file each.
+ */
+static int savePage(struct WriteParams *params, SDL_Surface *surface,
+                    const char *imageFileName)
+{
+  std::vector<Mip::Level> mips;
+  if (params->mips) {
+    Mip::generate((const uint32_t *)surface->pixels, surface->pitch,
+                  surface->w, surface->h, &mips, params->jobs);
+  }
+
+  if (params->compress || params->raw ||
+      params->pixelFormat != Convert::FormatRGBA8888) {
+    std::vector<std::vector<uint8_t> > data(mips.size() + 1);
+    std::vector<TextureFile::Level> levels(mips.size() + 1);
+    for (size_t i = 0; i < levels.size(); i++) {
+      const uint32_t *pixels = (const uint32_t *)surface->pixels;
+      int pitch = surface->pitch;
+      int width = surface->w;
+      int height = surface->h;
+      if (i > 0) {
+        pixels = &mips[i - 1].pixels[0];
+        width = mips[i - 1].width;
+        height = mips[i - 1].height;
+        pitch = width * sizeof(uint32_t);
+      }
 
-    for (int h = 32; h < 8192 * 2; h *= 2) {
-      for (int w = 32; w < 8192 * 2; w *= 2) {
-        resolutionList.push_back(new Dimension(w, h));
+      if (params->compress) {
+        data[i].resize(Compress::getSize(params->format, width, height));
+        Compress::encode(params->format, pixels, pitch, width, height,
+                         &data[i][0], params->jobs);
+      } else {
+        data[i].resize(Convert::getSize(params->pixelFormat, width, height));
+        Convert::convert(params->pixelFormat, params->dither, pixels, pitch,
+                         width, height, &data[i][0], params->jobs);
       }
+      levels[i].width = width;
+      levels[i].height = height;
+      levels[i].data = &data[i][0];
+      levels[i].size = data[i].size();
     }
 
-    /*
-     * Sum the total number of pixels
-     */
+    if (params->compress) {
+      return TextureFile::save(imageFileName, params->format, levels);
+    }
+    if (params->raw) {
+      return TextureFile::saveRaw(imageFileName, levels);
+    }
+    return TextureFile::save(imageFileName, params->pixelFormat, levels);
+  }
+
+  int err = PNG::save(surface, imageFileName, &params->png);
+  for (size_t i = 0; i < mips.size() && !err; i++) {
+    SDL_Surface *level = SDL_CreateRGBSurfaceFrom(
+        &mips[i].pixels[0], mips[i].width, mips[i].height, 32,
+        mips[i].width * sizeof(uint32_t), rmask, gmask, bmask, amask);
+    if (!level) {
+      return -1;
+    }
+    err = PNG::save(level, getMipFileName(imageFileName, i + 1).c_str(),
+                    &params->png);
+    SDL_FreeSurface(level);
+  }
+  return err;
+}
 
-    unsigned long long numPixels = 0;
-    for (it = imageList.begin(); it != imageList.end(); it++) {
-      Image *image = *it;
-      numPixels += image->getWidth() * image->getHeight();
-      numSprites++;
+/*
+ * Add a written page to the statistics, with its mip level files
+ */
+static void addPageFiles(Stats *stats, struct Options *options,
+                         const char *imageFileName, int width, int height)
+{
+  stats->addFile(imageFileName);
+  if (options->mips && strcmp(getPageExtension(options), "png") == 0) {
+    int numLevels = Mip::getNumLevels(width, height);
+    for (int i = 1; i < numLevels; i++) {
+      stats->addFile(getMipFileName(imageFileName, i).c_str());
     }
+  }
+}
 
-    /*
-     * Try to fit all images in the list surfaces with different
-     * resolutions, then choose to use the tree with the least waste
-     * of unused pixels.
-     *
-     * If there are more than one surface with the same amount of waste
-     * we use the one with its height/width ratio closest to 1.0.
-     */
+static void writePage(int index, int worker, void *param)
+{
+  struct WriteParams *params = (struct WriteParams *)param;
+  AtlasPage *page = &(*params->pages)[index];
+  int width = params->atlas->pages[index].width;
+  int height = params->atlas->pages[index].height;
+
+  double startTime = Stats::getWallTimeMs();
+  SDL_Surface *surface = SDL_CreateRGBSurface(0, width, height, 32, rmask,
+                                              gmask, bmask, amask);
+  if (!surface) {
+    page->err = -1;
+    return;
+  }
 
-    unsigned long long leastWaste = (unsigned long long)-1;
-    Atlas::Node *bestRoot = NULL;
-    Dimension *bestDimension = NULL;
-    double bestRatio = 0.0;
+  TextureAtlas::drawPage(*params->inputs, params->atlas, index,
+                         (uint32_t *)surface->pixels, surface->pitch,
+                         params->jobs);
 
-    for (rit = resolutionList.begin(); rit != resolutionList.end(); rit++) {
-      Dimension *dim = *rit;
+  double drawEndTime = Stats::getWallTimeMs();
+  page->drawTime = drawEndTime - startTime;
 
-      Atlas::Node *root = tryCreate(dim->mWidth, dim->mHeight, imageList);
+  page->err = savePage(params, surface, page->imageFileName);
+  if (params->surfaces) {
+    (*params->surfaces)[index] = surface;
+  } else {
+    SDL_FreeSurface(surface);
+  }
+  page->encodeTime = Stats::getWallTimeMs() - drawEndTime;
+}
 
-      if (root) {
+/*
+ * Add a string to a string table, returns its offset
+ */
+static uint32_t addString(std::vector<uint8_t> *strings, const std::string &str)
+{
+  uint32_t offset = strings->size();
+  strings->insert(strings->end(), str.begin(), str.end());
+  strings->push_back('\0');
+  return offset;
+}
 
-        /* Got a tree, compare it to the best so far */
+/*
+ * Write the atlas index as a binary sprite map (see SpriteMapBinHeader in
+ * SpriteDescriptor.h), loaded at runtime without parsing
+ */
+static int writeBinaryIndex(const char *atlasname, CacheManifest *manifest)
+{
+  char fileName[520];
+  snprintf(fileName, sizeof(fileName), "%s.bin", atlasname);
+
+  const uint32_t headerSize = sizeof(SpriteMapBinHeader);
+  const uint32_t pageSize = sizeof(SpritePageBinDescriptor);
+  const uint32_t spriteSize = sizeof(SpriteBinDescriptor);
+  uint32_t numPages = manifest->pages.size();
+  uint32_t numSprites = manifest->sprites.size();
+  uint32_t pagesOffset = headerSize;
+  uint32_t spritesOffset = pagesOffset + numPages * pageSize;
+  uint32_t stringsOffset = spritesOffset + numSprites * spriteSize;
+
+  std::vector<uint8_t> strings;
+  std::vector<uint8_t> records;
+  uint32_t name = addString(&strings, atlasname);
+
+  for (size_t i = 0; i < manifest->pages.size(); i++) {
+    CacheManifest::Page *page = &manifest->pages[i];
+    putUint32(&records, addString(&strings, page->imageFileName));
+    putUint32(&records, page->width);
+    putUint32(&records, page->height);
+  }
 
-        unsigned long long pixelWaste =
-            (dim->mWidth * dim->mHeight) - numPixels;
-        double ratio;
-        if (dim->mHeight < dim->mWidth)
-          ratio = (double)dim->mHeight / (double)dim->mWidth;
-        else
-          ratio = (double)dim->mWidth / (double)dim->mHeight;
+  for (size_t i = 0; i < manifest->sprites.size(); i++) {
+    SpriteRecord *sprite = &manifest->sprites[i];
+    putUint32(&records, addString(&strings, sprite->name));
+    putUint32(&records, sprite->page);
+    putUint32(&records, sprite->left);
+    putUint32(&records, sprite->top);
+    putUint32(&records, sprite->left + sprite->width);
+    putUint32(&records, sprite->top + sprite->height);
+    putUint32(&records, sprite->width);
+    putUint32(&records, sprite->height);
+    putUint32(&records, sprite->rotated);
+    putUint32(&records, sprite->trimLeft);
+    putUint32(&records, sprite->trimTop);
+    putUint32(&records, sprite->sourceWidth);
+    putUint32(&records, sprite->sourceHeight);
+  }
 
-        printf("Surface with dimension %d x %d created (ratio: %f, waste: %llu "
-               "pixels)\n",
-               dim->mWidth, dim->mHeight, ratio, pixelWaste);
+  std::vector<uint8_t> header(SPRITEMAP_BIN_MAGIC, SPRITEMAP_BIN_MAGIC + 4);
+  putUint32(&header, SPRITEMAP_BIN_VERSION);
+  putUint32(&header, stringsOffset + strings.size());
+  putUint32(&header, name);
+  putUint32(&header, numPages);
+  putUint32(&header, pagesOffset);
+  putUint32(&header, numSprites);
+  putUint32(&header, spritesOffset);
+  putUint32(&header, stringsOffset);
+  putUint32(&header, strings.size());
+
+  FILE *fp = fopen(fileName, "wb");
+  if (!fp) {
+    printf("Failed to create index file (%s): %s\n", fileName,
+           strerror(errno));
+    return -1;
+  }
+  fwrite(&header[0], 1, header.size(), fp);
+  fwrite(&records[0], 1, records.size(), fp);
+  fwrite(&strings[0], 1, strings.size(), fp);
+  if (ferror(fp) | fclose(fp)) {
+    printf("Failed to write index file (%s)\n", fileName);
+    return -1;
+  }
 
-        if (pixelWaste >= 0) {
-          if ((pixelWaste < leastWaste) ||
-              (pixelWaste == leastWaste && ratio > bestRatio)) {
-            printf("Surface with dimension %d x %d best so far\n", dim->mWidth,
-                   dim->mHeight);
+  printf("Successfully created atlas index file (%s)\n", fileName);
+  return 0;
+}
 
-            leastWaste = pixelWaste;
-            bestRoot = root;
-            bestDimension = dim;
-            bestRatio = ratio;
-          }
-        }
-      }
-    }
-    if (bestRoot) {
-
-      /*
-       * Create the final image
-       */
-
-      SDL_Surface *surface =
-          SDL_CreateRGBSurface(0, bestDimension->mWidth, bestDimension->mHeight,
-                               32, rmask, gmask, bmask, amask);
-      SDL_FillRect(
-          surface, NULL,
-          SDL_MapRGBA(surface->format, 0x00, 0x00, 0x00, 0x00)); // 0x00ffffff);
-      bestRoot->poTraversal(0, drawNode, surface);
-      char imgFileName[sizeof(atlasname) + 4];
-      char hFileName[sizeof(atlasname) + 4];
-      char cFileName[sizeof(atlasname) + 4];
-      const char *spriteDescriptorFileName = "SpriteDescriptor.h";
-      snprintf(imgFileName, sizeof(imgFileName), "%s.png", atlasname);
-      snprintf(hFileName, sizeof(hFileName), "%s.h", atlasname);
-      snprintf(cFileName, sizeof(cFileName), "%s.c", atlasname);
-      err = PNG::save(surface, imgFileName);
-      if (!err) {
-
-        printf("Successfully created atlas image file (%s)\n", imgFileName);
-
-        /* Create the atlas indexing files (c and header) */
-        FILE *spriteDescriptorFile;
-        struct OutputParams outputParams;
-        outputParams.indexOffset = 0;
-        outputParams.dimension = bestDimension;
-        outputParams.imageFileName = imgFileName;
-        outputParams.numSprites = numSprites;
-        outputParams.fmt = OutFmtFloats;
-
-        spriteDescriptorFile = fopen(spriteDescriptorFileName, "wb");
-        if (spriteDescriptorFile) {
-          char *p = &_binary_res_SpriteDescriptor_h_start;
-          while (p < &_binary_res_SpriteDescriptor_h_end) {
-            fputc(*p, spriteDescriptorFile);
-            p++;
-          }
-          fclose(spriteDescriptorFile);
-          printf("Successfully created sprite descriptor header (%s)\n",
-                 spriteDescriptorFileName);
-        } else {
-          printf("Failed to create sprite descriptor header (%s): %s\n",
-                 spriteDescriptorFileName, strerror(errno));
-        }
+/* Give up on the name hash if a bucket needs more tries than this */
+#define MAX_HASH_DISPLACEMENT (1 << 20)
 
-        outputParams.hFile = fopen(hFileName, "wb");
-        if (!outputParams.hFile) {
-          printf("Failed to create index file (%s): %s\n", hFileName,
-                 strerror(errno));
-          err = -1;
-        }
-#ifdef USE_CFILE
-        else {
-          outputParams.cFile = fopen(cFileName, "wb");
-          if (!outputParams.cFile) {
-            printf("Failed to create index file (%s): %s\n", cFileName,
-                   strerror(errno));
-            fclose(outputParams.hFile);
-            err = -1;
-          }
-        }
-#endif
+struct HashBucketOrder {
+  std::vector<std::vector<int> > *buckets;
 
-        if (!err) {
-          add_file_headers(&outputParams, atlasname);
+  /* Largest first, they are the hardest to place */
+  bool operator()(int a, int b)
+  {
+    return (*buckets)[a].size() > (*buckets)[b].size();
+  }
+};
 
-          bestRoot->poTraversal(0, storeIndex, &outputParams);
+/*
+ * Build a minimal perfect hash of the sprite names by hash and displace:
+ * names hash to buckets, and each bucket gets the hash seed (displacement)
+ * that sends all its names to free slots. Buckets of one name point to a
+ * free slot directly. Sprites sharing a name are found as the first one.
+ *
+ * Returns false if no hash was found.
+ */
+static bool buildNameHash(std::vector<SpriteRecord> &sprites,
+                          std::vector<int> *displacements,
+                          std::vector<unsigned int> *slots)
+{
+  std::unordered_map<std::string, int> names;
+  std::vector<int> keys;
+  for (size_t i = 0; i < sprites.size(); i++) {
+    if (names.insert(std::make_pair(sprites[i].name, (int)i)).second) {
+      keys.push_back(i);
+    }
+  }
 
-          add_file_footers(&outputParams, atlasname);
+  unsigned int numSlots = keys.size();
+  unsigned int numBuckets = numSlots;
+  std::vector<std::vector<int> > buckets(numBuckets);
+  for (size_t i = 0; i < keys.size(); i++) {
+    const char *name = sprites[keys[i]].name.c_str();
+    buckets[spritemap_hash_name(name, 0) % numBuckets].push_back(keys[i]);
+  }
 
-          fclose(outputParams.hFile);
-          printf("Successfully created atlas index file (%s)\n", hFileName);
+  std::vector<int> order(numBuckets);
+  for (unsigned int i = 0; i < numBuckets; i++) {
+    order[i] = i;
+  }
+  HashBucketOrder bucketOrder = {&buckets};
+  std::stable_sort(order.begin(), order.end(), bucketOrder);
+
+  std::vector<bool> used(numSlots, false);
+  std::vector<unsigned int> bucketSlots;
+  displacements->assign(numBuckets, 0);
+  slots->assign(numSlots, 0);
+
+  size_t b = 0;
+  for (; b < order.size() && buckets[order[b]].size() > 1; b++) {
+    std::vector<int> &bucket = buckets[order[b]];
+    int displacement = 0;
+    bool placed = false;
+
+    while (!placed) {
+      if (++displacement > MAX_HASH_DISPLACEMENT) {
+        displacements->clear();
+        slots->clear();
+        return false;
+      }
 
-#ifdef USE_CFILE
-          fclose(outputParams.cFile);
-          printf("Successfully created atlas index file (%s)\n", cFileName);
-#endif
-        }
+      placed = true;
+      bucketSlots.clear();
+      for (size_t i = 0; i < bucket.size() && placed; i++) {
+        unsigned int slot =
+            spritemap_hash_name(sprites[bucket[i]].name.c_str(),
+                                displacement) %
+            numSlots;
+        placed = !used[slot] && std::find(bucketSlots.begin(),
+                                          bucketSlots.end(),
+                                          slot) == bucketSlots.end();
+        bucketSlots.push_back(slot);
       }
     }
+
+    for (size_t i = 0; i < bucket.size(); i++) {
+      used[bucketSlots[i]] = true;
+      (*slots)[bucketSlots[i]] = bucket[i];
+    }
+    (*displacements)[order[b]] = displacement;
+  }
+
+  unsigned int freeSlot = 0;
+  for (; b < order.size() && buckets[order[b]].size() == 1; b++) {
+    while (used[freeSlot]) {
+      freeSlot++;
+    }
+    used[freeSlot] = true;
+    (*slots)[freeSlot] = buckets[order[b]][0];
+    (*displacements)[order[b]] = -1 - (int)freeSlot;
+  }
+
+  return true;
+}
+
+/*
+ * Write the atlas index files (c and header) and the sprite descriptor
+ * header they include
+ */
+static int writeIndex(const char *atlasname, CacheManifest *manifest,
+                      bool binary)
+{
+  int err = 0;
+  char hFileName[520];
+  char cFileName[520];
+  const char *spriteDescriptorFileName = "SpriteDescriptor.h";
+  snprintf(hFileName, sizeof(hFileName), "%s.h", atlasname);
+  snprintf(cFileName, sizeof(cFileName), "%s.c", atlasname);
+
+  FILE *spriteDescriptorFile;
+  struct OutputParams outputParams;
+  outputParams.indexOffset = 0;
+  outputParams.pages = &manifest->pages;
+  outputParams.numSprites = manifest->sprites.size();
+  outputParams.fmt = OutFmtFloats;
+
+  if (!buildNameHash(manifest->sprites, &outputParams.hashDisplacements,
+                     &outputParams.hashSlots)) {
+    printf("Failed to build the sprite name hash, lookups by name will "
+           "search all sprites\n");
+  }
+
+  spriteDescriptorFile = fopen(spriteDescriptorFileName, "wb");
+  if (spriteDescriptorFile) {
+    char *p = &_binary_res_SpriteDescriptor_h_start;
+    while (p < &_binary_res_SpriteDescriptor_h_end) {
+      fputc(*p, spriteDescriptorFile);
+      p++;
+    }
+    fclose(spriteDescriptorFile);
+    printf("Successfully created sprite descriptor header (%s)\n",
+           spriteDescriptorFileName);
+  } else {
+    printf("Failed to create sprite descriptor header (%s): %s\n",
+           spriteDescriptorFileName, strerror(errno));
+  }
+
+  if (binary && writeBinaryIndex(atlasname, manifest)) {
+    return -1;
+  }
+
+  outputParams.hFile = fopen(hFileName, "wb");
+  if (!outputParams.hFile) {
+    printf("Failed to create index file (%s): %s\n", hFileName,
+           strerror(errno));
+    err = -1;
+  }
+#ifdef USE_CFILE
+  else {
+    outputParams.cFile = fopen(cFileName, "wb");
+    if (!outputParams.cFile) {
+      printf("Failed to create index file (%s): %s\n", cFileName,
+             strerror(errno));
+      fclose(outputParams.hFile);
+      err = -1;
+    }
+  }
+#endif
+
+  if (!err) {
+    add_file_headers(&outputParams, atlasname);
+
+    for (size_t i = 0; i < manifest->sprites.size(); i++) {
+      storeSprite(&manifest->sprites[i], &outputParams);
+    }
+
+    add_file_footers(&outputParams, atlasname);
+
+    fclose(outputParams.hFile);
+    printf("Successfully created atlas index file (%s)\n", hFileName);
+
+#ifdef USE_CFILE
+    fclose(outputParams.cFile);
+    printf("Successfully created atlas index file (%s)\n", cFileName);
+#endif
+  }
+
+  return err;
+}
+
+/*
+ * Add the files written by writeIndex() to the statistics
+ */
+static void addIndexFiles(Stats *stats, const char *atlasname, bool binary)
+{
+  char fileName[520];
+
+  stats->addFile("SpriteDescriptor.h");
+  snprintf(fileName, sizeof(fileName), "%s.h", atlasname);
+  stats->addFile(fileName);
+#ifdef USE_CFILE
+  snprintf(fileName, sizeof(fileName), "%s.c", atlasname);
+  stats->addFile(fileName);
+#endif
+  if (binary) {
+    snprintf(fileName, sizeof(fileName), "%s.bin", atlasname);
+    stats->addFile(fileName);
+  }
+}
+
+/*
+ * Describe the options that change the output. A cache is only used by runs
+ * with the same signature.
+ */
+static std::string getSignature(struct Options *options)
+{
+  char signature[320];
+  snprintf(signature, sizeof(signature),
+           "max=%d search=%d packer=%d time-budget=%d rotate=%d npot=%d "
+           "align=%d trim=%d dedup=%d extrude=%d mips=%d png-level=%d "
+           "png-filter=%d png-fast=%d texture=%d pixel-format=%d dither=%d "
+           "premultiply=%d raw=%d binary=%d",
+           MAX_ATLAS_SIZE, (int)options->search, (int)options->packer,
+           options->timeBudget, (int)options->allowRotate,
+           (int)options->npot, options->align, (int)options->trim,
+           (int)options->dedup, options->extrude, (int)options->mips,
+           options->png.level, (int)options->png.filter,
+           (int)options->png.fast,
+           options->compress ? (int)options->format : -1,
+           (int)options->pixelFormat, (int)options->dither,
+           (int)options->premultiply, (int)options->raw,
+           (int)options->binary);
+  return signature;
+}
+
+static bool fileExists(const char *fileName)
+{
+  FILE *fp = fopen(fileName, "rb");
+  if (fp) {
+    fclose(fp);
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Describe changed images (inputs, by input index in changed) as sprites in
+ * the places of their old sprites. Without dedup there is exactly one
+ * sprite per input, spriteIndexes gets the index of each in the manifest.
+ *
+ * Returns false if an image has no sprite or no longer fits the area
+ * reserved for it in the atlas.
+ */
+static bool placeInputs(struct Options *options, CacheManifest *manifest,
+                        const std::vector<int> &changed,
+                        const std::vector<TextureAtlas::Input> &inputs,
+                        std::vector<SpriteRecord> *sprites,
+                        std::vector<int> *spriteIndexes)
+{
+  std::vector<int> spriteOfInput(manifest->inputs.size(), -1);
+  for (size_t i = 0; i < manifest->sprites.size(); i++) {
+    int input = manifest->sprites[i].input;
+    if (input >= 0 && input < (int)spriteOfInput.size()) {
+      spriteOfInput[input] = i;
+    }
+  }
+
+  sprites->resize(changed.size());
+  spriteIndexes->resize(changed.size());
+
+  for (size_t i = 0; i < changed.size(); i++) {
+    int spriteIndex = spriteOfInput[changed[i]];
+    if (spriteIndex < 0) {
+      return false;
+    }
+
+    /* The sprite as it is now, in the place of the old one */
+    SpriteRecord *sprite = &(*sprites)[i];
+    int width, height;
+    *sprite = manifest->sprites[spriteIndex];
+    TextureAtlas::findSpriteArea(&inputs[i], options->trim, &sprite->trimLeft,
+                                 &sprite->trimTop, &width, &height);
+    sprite->width = sprite->rotated ? height : width;
+    sprite->height = sprite->rotated ? width : height;
+    sprite->sourceWidth = inputs[i].width;
+    sprite->sourceHeight = inputs[i].height;
+    (*spriteIndexes)[i] = spriteIndex;
+
+    if (sprite->width + 2 * options->extrude > sprite->slotWidth ||
+        sprite->height + 2 * options->extrude > sprite->slotHeight) {
+      printf("Image %s no longer fits its place in the atlas, rebuilding\n",
+             options->fileNames[changed[i]]);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Clear the place reserved for a sprite on a page and draw its image, with
+ * its extruded border
+ */
+static void redrawSprite(SDL_Surface *surface,
+                         const TextureAtlas::Input *input,
+                         const SpriteRecord *sprite, int extrude)
+{
+  SDL_Rect slot;
+  slot.x = sprite->left - extrude;
+  slot.y = sprite->top - extrude;
+  slot.w = sprite->slotWidth;
+  slot.h = sprite->slotHeight;
+  SDL_FillRect(surface, &slot,
+               SDL_MapRGBA(surface->format, 0x00, 0x00, 0x00, 0x00));
+  TextureAtlas::drawSprite(input, sprite, (uint32_t *)surface->pixels,
+                           surface->pitch);
+  TextureAtlas::extrudeSprite(sprite, extrude, (uint32_t *)surface->pixels,
+                              surface->pitch);
+}
+
+/*
+ * Bring the atlas up to date using the cache of the previous run, without
+ * packing the images again. Nothing is done when no input changed. Images
+ * that changed are redrawn in place, if they still fit there.
+ *
+ * Returns true if the atlas is up to date, false if it needs a full
+ * rebuild.
+ */
+static bool updateFromCache(const char *atlasname, const char *cacheFileName,
+                            struct Options *options, Stats *stats)
+{
+  CacheManifest manifest;
+  char fileName[520];
+
+  if (Cache::load(cacheFileName, &manifest)) {
+    return false;
+  }
+
+  if (manifest.signature != getSignature(options)) {
+    printf("Options changed since the last run, rebuilding\n");
+    return false;
+  }
+
+  bool sameInputs = manifest.inputs.size() == options->files.size();
+  for (size_t i = 0; i < manifest.inputs.size() && sameInputs; i++) {
+    sameInputs = manifest.inputs[i].path == options->files[i];
+  }
+  if (!sameInputs) {
+    printf("Image files changed since the last run, rebuilding\n");
+    return false;
+  }
+
+  /* The outputs of the last run must still be there */
+  bool outputsExist = fileExists("SpriteDescriptor.h");
+  snprintf(fileName, sizeof(fileName), "%s.h", atlasname);
+  outputsExist = outputsExist && fileExists(fileName);
+#ifdef USE_CFILE
+  snprintf(fileName, sizeof(fileName), "%s.c", atlasname);
+  outputsExist = outputsExist && fileExists(fileName);
+#endif
+  snprintf(fileName, sizeof(fileName), "%s.bin", atlasname);
+  outputsExist = outputsExist && (!options->binary || fileExists(fileName));
+  /* Mips are files of their own only next to PNG pages */
+  bool mipFiles =
+      options->mips && strcmp(getPageExtension(options), "png") == 0;
+  for (size_t i = 0; i < manifest.pages.size() && outputsExist; i++) {
+    const char *imageFileName = manifest.pages[i].imageFileName.c_str();
+    outputsExist = fileExists(imageFileName);
+    int numLevels = Mip::getNumLevels(manifest.pages[i].width,
+                                      manifest.pages[i].height);
+    for (int j = 1; j < numLevels && mipFiles && outputsExist; j++) {
+      outputsExist = fileExists(getMipFileName(imageFileName, j).c_str());
+    }
+  }
+  if (!outputsExist) {
+    return false;
+  }
+
+  /*
+   * Inputs with a new time or size are hashed, only those with new content
+   * are loaded
+   */
+
+  struct LoadParams loadParams;
+  loadParams.options = options;
+  bool touched = false;
+
+  for (size_t i = 0; i < manifest.inputs.size(); i++) {
+    CacheManifest::Input *input = &manifest.inputs[i];
+    long long mtime, size;
+    uint64_t hash;
+
+    if (Cache::statInput(input->path.c_str(), &mtime, &size)) {
+      return false;
+    }
+    if (mtime == input->mtime && size == input->size) {
+      continue;
+    }
+
+    if (Cache::hashInput(input->path.c_str(), &hash)) {
+      return false;
+    }
+    if (hash != input->hash) {
+      loadParams.inputs.push_back(i);
+    }
+    input->mtime = mtime;
+    input->size = size;
+    input->hash = hash;
+    touched = true;
+  }
+
+  if (loadParams.inputs.empty()) {
+    if (touched) {
+      Cache::save(cacheFileName, &manifest);
+      stats->addFile(cacheFileName);
+    }
+    printf("Atlas %s is up to date\n", atlasname);
+    stats->numImages = manifest.inputs.size();
+    stats->numPages = manifest.pages.size();
+    stats->setStatus("up to date");
+    return true;
+  }
+
+  if (options->dedup || strcmp(getPageExtension(options), "png") != 0) {
+    /*
+     * A changed image may now be, or no longer be, a duplicate. Only PNG
+     * pages can be loaded to draw on.
+     */
+    printf("%d images changed, rebuilding\n", (int)loadParams.inputs.size());
+    return false;
+  }
+
+  loadParams.surfaces.assign(loadParams.inputs.size(), NULL);
+  Parallel::forEach(loadParams.inputs.size(), options->jobs, loadImage,
+                    &loadParams);
+
+  std::vector<TextureAtlas::Input> inputs(loadParams.inputs.size());
+  std::vector<SpriteRecord> sprites;
+  std::vector<int> spriteIndexes;
+  bool fits = true;
+
+  for (size_t i = 0; i < loadParams.inputs.size() && fits; i++) {
+    if (!loadParams.surfaces[i]) {
+      fits = false;
+      break;
+    }
+    setInput(&inputs[i], NULL, loadParams.surfaces[i]);
+  }
+
+  fits = fits && placeInputs(options, &manifest, loadParams.inputs, inputs,
+                             &sprites, &spriteIndexes);
+
+  if (fits) {
+
+    /*
+     * Redraw only the places of the changed images, page by page
+     */
+
+    for (size_t i = 0; i < manifest.pages.size() && fits; i++) {
+      const char *imageFileName = manifest.pages[i].imageFileName.c_str();
+      SDL_Surface *surface = NULL;
+
+      for (size_t j = 0; j < sprites.size() && fits; j++) {
+        SpriteRecord *sprite = &sprites[j];
+        if (sprite->page != (int)i) {
+          continue;
+        }
+
+        if (!surface) {
+          SDL_Surface *loaded = IMG_Load(imageFileName);
+          if (loaded) {
+            surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32,
+                                               0);
+            SDL_FreeSurface(loaded);
+          }
+          if (!surface) {
+            fits = false;
+            break;
+          }
+        }
+
+        redrawSprite(surface, &inputs[j], sprite, options->extrude);
+        manifest.sprites[spriteIndexes[j]] = *sprite;
+      }
+
+      if (surface) {
+        struct WriteParams writeParams;
+        setWriteOptions(&writeParams, options,
+                        Parallel::getNumWorkers(INT_MAX, options->jobs));
+        if (savePage(&writeParams, surface, imageFileName)) {
+          printf("Failed to update atlas image file (%s)\n", imageFileName);
+          fits = false;
+        } else {
+          printf("Successfully updated atlas image file (%s)\n",
+                 imageFileName);
+          addPageFiles(stats, options, imageFileName, surface->w,
+                       surface->h);
+        }
+        SDL_FreeSurface(surface);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < loadParams.surfaces.size(); i++) {
+    if (loadParams.surfaces[i]) {
+      SDL_FreeSurface(loadParams.surfaces[i]);
+    }
+  }
+
+  if (!fits || writeIndex(atlasname, &manifest, options->binary)) {
+    return false;
+  }
+
+  printf("Updated %d changed images in place\n",
+         (int)loadParams.inputs.size());
+  Cache::save(cacheFileName, &manifest);
+  addIndexFiles(stats, atlasname, options->binary);
+  stats->addFile(cacheFileName);
+  stats->numImages = manifest.inputs.size();
+  stats->numPages = manifest.pages.size();
+  stats->setStatus("updated");
+  return true;
+}
+
+/*
+ * Pack the loaded images and write the pages, the index and the cache. The
+ * manifest must have the signature and inputs of the run, it gets the
+ * pages and sprites. Drawn pages are kept in pageSurfaces unless it is
+ * NULL.
+ */
+static int buildAtlas(const char *atlasname, const char *cacheFileName,
+                      struct Options *options,
+                      std::vector<TextureAtlas::Input> &inputs,
+                      CacheManifest *manifest,
+                      std::vector<SDL_Surface *> *pageSurfaces, Stats *stats)
+{
+  int err = 0;
+
+  TextureAtlas::Options atlasOptions;
+  TextureAtlas::Result atlas;
+  getAtlasOptions(options, &atlasOptions);
+  manifest->pages.clear();
+  manifest->sprites.clear();
+
+  stats->beginPhase(Stats::PhaseSearch);
+  if (TextureAtlas::pack(inputs, &atlasOptions, &atlas)) {
+    printf("Failed to fit image %s in the largest atlas size (%d x %d)\n",
+           options->fileNames[atlas.failedInput], MAX_ATLAS_SIZE,
+           MAX_ATLAS_SIZE);
+    err = -1;
+  }
+  stats->endPhase(Stats::PhaseSearch);
+
+  stats->numAttempts = atlas.numAttempts;
+  stats->numNodes = atlas.numNodesCreated;
+  stats->numPixels = atlas.numPixels;
+  stats->numPages = atlas.pages.size();
+  for (size_t i = 0; i < atlas.pages.size(); i++) {
+    stats->atlasArea +=
+        (unsigned long long)atlas.pages[i].width * atlas.pages[i].height;
+  }
+
+  std::vector<AtlasPage> pages(err ? 0 : atlas.pages.size());
+
+  if (!err && !pages.empty()) {
+
+    /*
+     * Create the final images, one file per page
+     */
+
+    for (size_t i = 0; i < pages.size(); i++) {
+      const char *extension = getPageExtension(options);
+      if (pages.size() == 1) {
+        snprintf(pages[i].imageFileName, sizeof(pages[i].imageFileName),
+                 "%s.%s", atlasname, extension);
+      } else {
+        snprintf(pages[i].imageFileName, sizeof(pages[i].imageFileName),
+                 "%s_%d.%s", atlasname, (int)i, extension);
+      }
+      pages[i].err = 0;
+      pages[i].drawTime = 0.0;
+      pages[i].encodeTime = 0.0;
+    }
+
+    /*
+     * Threads not needed for writing pages side by side draw and encode
+     * within a page
+     */
+    struct WriteParams writeParams;
+    writeParams.pages = &pages;
+    writeParams.inputs = &inputs;
+    writeParams.atlas = &atlas;
+    int numWorkers = Parallel::getNumWorkers(INT_MAX, options->jobs);
+    setWriteOptions(&writeParams, options,
+                    std::max(1, numWorkers / (int)pages.size()));
+    writeParams.surfaces = pageSurfaces;
+    if (pageSurfaces) {
+      pageSurfaces->assign(pages.size(), NULL);
+    }
+
+    stats->beginPhase(Stats::PhaseWrite);
+    Parallel::forEach(pages.size(), options->jobs, writePage, &writeParams);
+    stats->endPhase(Stats::PhaseWrite);
+
+    for (size_t i = 0; i < pages.size(); i++) {
+      stats->addPageTime(pages[i].drawTime, pages[i].encodeTime);
+      if (pages[i].err) {
+        printf("Failed to create atlas image file (%s)\n",
+               pages[i].imageFileName);
+        err = -1;
+      } else {
+        printf("Successfully created atlas image file (%s)\n",
+               pages[i].imageFileName);
+        addPageFiles(stats, options, pages[i].imageFileName,
+                     atlas.pages[i].width, atlas.pages[i].height);
+      }
+    }
+
+    stats->beginPhase(Stats::PhaseIndex);
+
+    if (!err) {
+      for (size_t i = 0; i < pages.size(); i++) {
+        CacheManifest::Page page;
+        page.imageFileName = pages[i].imageFileName;
+        page.width = atlas.pages[i].width;
+        page.height = atlas.pages[i].height;
+        manifest->pages.push_back(page);
+      }
+      manifest->sprites.swap(atlas.sprites);
+
+      err = writeIndex(atlasname, manifest, options->binary);
+    }
+
+    if (!err) {
+      addIndexFiles(stats, atlasname, options->binary);
+      if (!Cache::save(cacheFileName, manifest)) {
+        stats->addFile(cacheFileName);
+      }
+      stats->setStatus("built");
+    }
+
+    stats->endPhase(Stats::PhaseIndex);
+  }
+
+  return err;
+}
+
+/*
+ * Write the statistics file, if one was asked for
+ */
+static int writeStats(struct Options *options, Stats *stats)
+{
+  if (!options->statsFileName) {
+    return 0;
+  }
+  if (stats->save(options->statsFileName)) {
+    printf("Failed to create statistics file (%s): %s\n",
+           options->statsFileName, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Time to wait for more changes after one, so that a batch of saves gives
+ * one update
+ */
+#define WATCH_SETTLE_MS 20
+
+/* File name extensions of the images taken from directories */
+static const char *imageExtensions[] = {
+    "png", "jpg", "jpeg", "bmp", "gif", "tga", "tif", "tiff", "webp",
+    "pcx", "pnm", "ppm", "pgm", "pbm", "xpm", "lbm", "qoi", "svg",
+};
+
+#define NUM_IMAGE_EXTENSIONS                                                   \
+  (sizeof(imageExtensions) / sizeof(imageExtensions[0]))
+
+static bool isImageFile(const char *fileName)
+{
+  /* Hidden files are left out, editors save to those before renaming */
+  const char *extension = strrchr(fileName, '.');
+  if (fileName[0] == '.' || !extension) {
+    return false;
+  }
+
+  for (unsigned int i = 0; i < NUM_IMAGE_EXTENSIONS; i++) {
+    if (strcasecmp(extension + 1, imageExtensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Whether a file is a page of the atlas, name.ext or name_N.ext, or one of
+ * their mip levels, name_mipN.ext or name_N_mipN.ext
+ */
+static bool isAtlasPage(const char *fileName, const char *atlasBase)
+{
+  size_t len = strlen(atlasBase);
+  if (strncmp(fileName, atlasBase, len) != 0) {
+    return false;
+  }
+
+  const char *p = fileName + len;
+  if (*p == '_' && p[1] >= '0' && p[1] <= '9') {
+    p++;
+    while (*p >= '0' && *p <= '9') {
+      p++;
+    }
+  }
+  if (strncmp(p, "_mip", 4) == 0) {
+    p += 4;
+    while (*p >= '0' && *p <= '9') {
+      p++;
+    }
+  }
+  return *p == '.' && !strchr(p + 1, '.');
+}
+
+/*
+ * What watch mode keeps in memory from one update to the next
+ */
+struct WatchState {
+  const char *atlasname;
+  const char *cacheFileName;
+  struct Options *options;
+
+  /* Name of the atlas pages to leave out, if written to the directory */
+  const char *atlasBase;
+
+  /* The images, sorted by file name, NULL surfaces failed to load */
+  std::vector<std::string> files;
+  std::vector<std::string> fileNames;
+  std::vector<std::string> names;
+  std::vector<SDL_Surface *> surfaces;
+
+  /* Inputs (by image) and layout of the last build */
+  CacheManifest manifest;
+
+  /* Pages of the last build as drawn, empty if it failed */
+  std::vector<SDL_Surface *> pages;
+};
+
+/*
+ * List the images in a directory, sorted by name so the atlas does not
+ * depend on the order of the directory entries. Pages of the atlas named
+ * atlasBase are left out, unless it is NULL.
+ */
+static int listImageFiles(const char *dirName, const char *atlasBase,
+                          std::vector<std::string> *fileNames)
+{
+  DIR *dir = opendir(dirName);
+  if (!dir) {
+    return -1;
+  }
+
+  fileNames->clear();
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    if (entry->d_type != DT_DIR && isImageFile(entry->d_name) &&
+        !(atlasBase && isAtlasPage(entry->d_name, atlasBase))) {
+      fileNames->push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+
+  std::sort(fileNames->begin(), fileNames->end());
+  return 0;
+}
+
+/*
+ * File name of the atlas without the directory part, if the atlas is
+ * written to the given directory, else NULL
+ */
+static const char *getAtlasBaseIn(const char *atlasname, const char *dirName)
+{
+  const char *atlasBase = strrchr(atlasname, '/');
+  std::string atlasDir = atlasBase ? std::string(atlasname, atlasBase) : ".";
+  struct stat dirStat, atlasStat;
+  if (!stat(dirName, &dirStat) &&
+      !stat(atlasDir.empty() ? "/" : atlasDir.c_str(), &atlasStat) &&
+      dirStat.st_dev == atlasStat.st_dev &&
+      dirStat.st_ino == atlasStat.st_ino) {
+    return atlasBase ? atlasBase + 1 : atlasname;
+  }
+  return NULL;
+}
+
+/*
+ * Add an image file read from a list or directory to the inputs, its path
+ * kept in the name pool
+ */
+static void addInput(struct Options *options, std::vector<const char *> *files,
+                     std::vector<const char *> *fileNames, const char *path,
+                     size_t len)
+{
+  const char *file = options->names.intern(path, len);
+  const char *slash = strrchr(file, '/');
+  files->push_back(file);
+  fileNames->push_back(slash ? slash + 1 : file);
+}
+
+/*
+ * Add the image files of a file list, one path per line. Empty lines and
+ * lines starting with # are skipped.
+ */
+static int addListedInputs(struct Options *options, const char *listFileName,
+                           std::vector<const char *> *files,
+                           std::vector<const char *> *fileNames)
+{
+  FILE *fp = fopen(listFileName, "rb");
+  if (!fp) {
+    printf("Failed to open file list (%s): %s\n", listFileName,
+           strerror(errno));
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t lineSize = 0;
+  ssize_t len;
+  while ((len = getline(&line, &lineSize, fp)) >= 0) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      len--;
+    }
+    if (len > 0 && line[0] != '#') {
+      addInput(options, files, fileNames, line, len);
+    }
+  }
+  free(line);
+
+  int err = ferror(fp) ? -1 : 0;
+  fclose(fp);
+  if (err) {
+    printf("Failed to read file list (%s)\n", listFileName);
+  }
+  return err;
+}
+
+/*
+ * Replace image file arguments that are @lists or directories with the
+ * image files in them
+ */
+static int expandInputs(const char *atlasname, struct Options *options)
+{
+  std::vector<const char *> files;
+  std::vector<const char *> fileNames;
+  std::vector<std::string> dirFileNames;
+  int err = 0;
+
+  for (size_t i = 0; i < options->files.size() && !err; i++) {
+    const char *file = options->files[i];
+    struct stat fileStat;
+
+    if (file[0] == '@') {
+      err = addListedInputs(options, file + 1, &files, &fileNames);
+    } else if (!stat(file, &fileStat) && S_ISDIR(fileStat.st_mode)) {
+      if (listImageFiles(file, getAtlasBaseIn(atlasname, file),
+                         &dirFileNames)) {
+        printf("Failed to read directory %s: %s\n", file, strerror(errno));
+        err = -1;
+      }
+      for (size_t j = 0; j < dirFileNames.size(); j++) {
+        std::string path = std::string(file) + "/" + dirFileNames[j];
+        addInput(options, &files, &fileNames, path.c_str(), path.size());
+      }
+    } else {
+      files.push_back(file);
+      fileNames.push_back(options->fileNames[i]);
+    }
+  }
+
+  if (!err && files.empty()) {
+    printf("No image files found\n");
+    err = -1;
+  }
+
+  options->files.swap(files);
+  options->fileNames.swap(fileNames);
+  return err;
+}
+
+static void freeSurfaces(std::vector<SDL_Surface *> *surfaces)
+{
+  for (size_t i = 0; i < surfaces->size(); i++) {
+    if ((*surfaces)[i]) {
+      SDL_FreeSurface((*surfaces)[i]);
+    }
+  }
+  surfaces->clear();
+}
+
+/*
+ * Redraw changed images in their places on the pages of the last build and
+ * write the pages they are on, the index and the cache.
+ *
+ * Returns 0 on success, 1 if an image does not fit its place (nothing is
+ * written then), else error.
+ */
+static int updateWatchedInPlace(struct WatchState *state,
+                                 const std::vector<int> &changed,
+                                 Stats *stats)
+{
+  struct Options *options = state->options;
+  CacheManifest *manifest = &state->manifest;
+
+  std::vector<TextureAtlas::Input> inputs(changed.size());
+  std::vector<SpriteRecord> sprites;
+  std::vector<int> spriteIndexes;
+  for (size_t i = 0; i < changed.size(); i++) {
+    setInput(&inputs[i], NULL, state->surfaces[changed[i]]);
+  }
+  if (!placeInputs(options, manifest, changed, inputs, &sprites,
+                   &spriteIndexes)) {
+    return 1;
+  }
+
+  stats->beginPhase(Stats::PhaseWrite);
+  std::vector<bool> pageChanged(state->pages.size(), false);
+  for (size_t i = 0; i < sprites.size(); i++) {
+    redrawSprite(state->pages[sprites[i].page], &inputs[i], &sprites[i],
+                 options->extrude);
+    manifest->sprites[spriteIndexes[i]] = sprites[i];
+    pageChanged[sprites[i].page] = true;
+  }
+
+  /* Pages are saved one at a time, each with every thread */
+  struct WriteParams writeParams;
+  setWriteOptions(&writeParams, options,
+                  Parallel::getNumWorkers(INT_MAX, options->jobs));
+
+  int err = 0;
+  for (size_t i = 0; i < state->pages.size(); i++) {
+    if (!pageChanged[i]) {
+      continue;
+    }
+    const char *imageFileName = manifest->pages[i].imageFileName.c_str();
+    if (savePage(&writeParams, state->pages[i], imageFileName)) {
+      printf("Failed to update atlas image file (%s)\n", imageFileName);
+      err = -1;
+    } else {
+      printf("Successfully updated atlas image file (%s)\n", imageFileName);
+      addPageFiles(stats, options, imageFileName, state->pages[i]->w,
+                   state->pages[i]->h);
+    }
+  }
+  stats->endPhase(Stats::PhaseWrite);
+
+  stats->beginPhase(Stats::PhaseIndex);
+  if (!err) {
+    err = writeIndex(state->atlasname, manifest, options->binary);
+  }
+  if (!err) {
+    addIndexFiles(stats, state->atlasname, options->binary);
+    if (!Cache::save(state->cacheFileName, manifest)) {
+      stats->addFile(state->cacheFileName);
+    }
+    stats->setStatus("updated");
+  }
+  stats->endPhase(Stats::PhaseIndex);
+
+  /* A failed write leaves pages that do not match the files */
+  if (err) {
+    freeSurfaces(&state->pages);
+  }
+  return err;
+}
+
+/*
+ * Bring the atlas up to date with the directory. Only images that are new
+ * or have new content are loaded, the others are kept from the last
+ * update. changed has the names of the files that changed, an empty name
+ * for any file.
+ *
+ * Returns 0 if the atlas was updated, 1 if nothing changed, else error.
+ */
+static int updateWatched(struct WatchState *state,
+                         const std::vector<std::string> &changed)
+{
+  int err = 0;
+  struct Options *options = state->options;
+  Stats stats;
+  std::vector<std::string> fileNames;
+
+  stats.beginPhase(Stats::PhaseLoad);
+  if (listImageFiles(options->watchDir, state->atlasBase, &fileNames)) {
+    printf("Failed to read directory %s: %s\n", options->watchDir,
+           strerror(errno));
+    return -1;
+  }
+
+  bool anyFile =
+      std::find(changed.begin(), changed.end(), "") != changed.end();
+  bool sameFiles = fileNames == state->fileNames;
+  int numFiles = fileNames.size();
+
+  /*
+   * Take over the images still in the directory, both lists are sorted.
+   * Changed files are hashed, those with new content are loaded.
+   */
+
+  std::vector<std::string> files(numFiles);
+  std::vector<std::string> names(numFiles);
+  std::vector<SDL_Surface *> surfaces(numFiles, NULL);
+  std::vector<CacheManifest::Input> inputs(numFiles);
+  struct LoadParams loadParams;
+  loadParams.options = options;
+
+  size_t known = 0;
+  for (int i = 0; i < numFiles; i++) {
+    files[i] = std::string(options->watchDir) + "/" + fileNames[i];
+    names[i] = getSpriteName(fileNames[i].c_str());
+    inputs[i].path = files[i];
+    inputs[i].hash = 0;
+
+    while (known < state->fileNames.size() &&
+           state->fileNames[known] < fileNames[i]) {
+      known++;
+    }
+    if (known < state->fileNames.size() &&
+        state->fileNames[known] == fileNames[i]) {
+      surfaces[i] = state->surfaces[known];
+      inputs[i] = state->manifest.inputs[known];
+      state->surfaces[known] = NULL;
+    }
+
+    bool touched = anyFile || std::find(changed.begin(), changed.end(),
+                                        fileNames[i]) != changed.end();
+    if (surfaces[i] && !touched) {
+      continue;
+    }
+
+    CacheManifest::Input *input = &inputs[i];
+    uint64_t hash = 0;
+    if (Cache::statInput(input->path.c_str(), &input->mtime, &input->size) ||
+        Cache::hashInput(input->path.c_str(), &hash)) {
+      input->mtime = -1;
+      input->size = -1;
+    } else if (surfaces[i] && hash == input->hash) {
+      continue;
+    }
+    input->hash = hash;
+    loadParams.inputs.push_back(i);
+  }
+
+  /* Images no longer in the directory */
+  freeSurfaces(&state->surfaces);
+
+  state->files.swap(files);
+  state->fileNames.swap(fileNames);
+  state->names.swap(names);
+  state->surfaces.swap(surfaces);
+  state->manifest.inputs.swap(inputs);
+
+  /* The sprites of the last build refer to the images by index */
+  if (!sameFiles) {
+    freeSurfaces(&state->pages);
+  }
+  options->files.resize(numFiles);
+  options->fileNames.resize(numFiles);
+  for (int i = 0; i < numFiles; i++) {
+    options->files[i] = state->files[i].c_str();
+    options->fileNames[i] = state->fileNames[i].c_str();
+  }
+
+  loadParams.surfaces.assign(loadParams.inputs.size(), NULL);
+  Parallel::forEach(loadParams.inputs.size(), options->jobs, loadImage,
+                    &loadParams);
+
+  for (size_t i = 0; i < loadParams.inputs.size(); i++) {
+    int input = loadParams.inputs[i];
+    if (state->surfaces[input]) {
+      SDL_FreeSurface(state->surfaces[input]);
+    }
+    state->surfaces[input] = loadParams.surfaces[i];
+
+    /* Loaded again on the next change, it may be half written */
+    if (!loadParams.surfaces[i]) {
+      printf("Error loading image %s\n", options->files[input]);
+      state->manifest.inputs[input].hash = 0;
+      err = -1;
+    }
+  }
+  stats.endPhase(Stats::PhaseLoad);
+  stats.numImages = numFiles;
+
+  if (err) {
+    return err;
+  }
+  if (loadParams.inputs.empty() && !state->pages.empty()) {
+    return 1;
+  }
+
+  /*
+   * Without dedup a changed image can not change other sprites, it is
+   * redrawn in its place if it still fits there
+   */
+
+  int inPlace = 1;
+  if (!state->pages.empty() && !options->dedup) {
+    inPlace = updateWatchedInPlace(state, loadParams.inputs, &stats);
+  }
+
+  if (inPlace == 0) {
+    printf("Updated %d changed images in place\n",
+           (int)loadParams.inputs.size());
+    stats.numPages = state->pages.size();
+  } else if (inPlace < 0) {
+    err = -1;
+  } else {
+
+    /* Pack everything again, from the images in memory */
+
+    freeSurfaces(&state->pages);
+    remove(state->cacheFileName);
+    state->manifest.signature = getSignature(options);
+
+    if (numFiles == 0) {
+      printf("No images in %s\n", options->watchDir);
+      return 1;
+    }
+
+    std::vector<TextureAtlas::Input> atlasInputs(numFiles);
+    for (int i = 0; i < numFiles; i++) {
+      setInput(&atlasInputs[i], state->names[i].c_str(),
+               state->surfaces[i]);
+    }
+
+    err = buildAtlas(state->atlasname, state->cacheFileName, options,
+                     atlasInputs, &state->manifest, &state->pages, &stats);
+    if (err) {
+      freeSurfaces(&state->pages);
+    }
+  }
+
+  if (writeStats(options, &stats)) {
+    err = -1;
+  }
+  return err;
+}
+
+static volatile sig_atomic_t watchStopped = 0;
+
+static void stopWatching(int sig)
+{
+  watchStopped = 1;
+}
+
+/*
+ * Build the atlas from the images in a directory, then update it each time
+ * they change until interrupted (Ctrl+C)
+ */
+static int watchDirectory(const char *atlasname, const char *cacheFileName,
+                          struct Options *options)
+{
+  int err = 0;
+  Watch watch;
+
+  if (watch.open(options->watchDir)) {
+    printf("Failed to watch directory %s: %s\n", options->watchDir,
+           strerror(errno));
+    return -1;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopWatching;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  struct WatchState state;
+  state.atlasname = atlasname;
+  state.cacheFileName = cacheFileName;
+  state.options = options;
+
+  /* Pages written to the directory must not be taken for images */
+  state.atlasBase = getAtlasBaseIn(atlasname, options->watchDir);
+
+  /* Everything is new to the first update */
+  std::vector<std::string> changed(1, "");
+  bool first = true;
+
+  while (!watchStopped) {
+    double startTime = Stats::getWallTimeMs();
+    if (updateWatched(&state, changed) == 0 && !options->quiet) {
+      printf("Atlas %s updated in %.1f ms\n", atlasname,
+             Stats::getWallTimeMs() - startTime);
+    }
+    if (first && !options->quiet) {
+      printf("Watching %s for changes, press Ctrl+C to stop\n",
+             options->watchDir);
+    }
+    first = false;
+    fflush(stdout);
+
+    /* Wait for a change to an image, not to other files */
+    bool imageChanged = false;
+    while (!imageChanged) {
+      changed.clear();
+      int ret = watch.wait(WATCH_SETTLE_MS, &changed);
+      if (ret != 0) {
+        if (ret > 0) {
+          printf("Directory %s is gone, stopped watching\n",
+                 options->watchDir);
+          err = -1;
+        } else if (errno != EINTR) {
+          printf("Failed to watch directory %s: %s\n", options->watchDir,
+                 strerror(errno));
+          err = -1;
+        }
+        watchStopped = 1;
+        break;
+      }
+      for (size_t i = 0; i < changed.size() && !imageChanged; i++) {
+        imageChanged =
+            changed[i].empty() ||
+            (isImageFile(changed[i].c_str()) &&
+             !(state.atlasBase &&
+               isAtlasPage(changed[i].c_str(), state.atlasBase)));
+      }
+    }
+  }
+
+  freeSurfaces(&state.surfaces);
+  freeSurfaces(&state.pages);
+  return err;
+}
+
+int main(int argc, char *argv[])
+{
+  int err = 0;
+  unsigned int seed = time(NULL);
+  //  seed = 1343398170;
+  srand(seed);
+
+  std::vector<SDL_Surface *> surfaces;
+  Stats stats;
+
+  /* Default atlas name */
+  char atlasname[512] = "unnamed_atlas";
+
+  /* Default options */
+  struct Options options;
+  options.jobs = 1;
+  options.search = Search::StrategyPruned;
+  options.packer = Atlas::PackerGuillotine;
+  options.timeBudget = 0;
+  options.allowRotate = false;
+  options.npot = false;
+  options.align = 1;
+  options.trim = false;
+  options.dedup = false;
+  options.extrude = 0;
+  options.mips = false;
+  options.cache = true;
+  options.compress = false;
+  options.format = Compress::FormatBC1;
+  options.pixelFormat = Convert::FormatRGBA8888;
+  options.dither = Convert::DitherNone;
+  options.premultiply = false;
+  options.raw = false;
+  options.binary = false;
+  options.quiet = false;
+  options.statsFileName = NULL;
+  options.watchDir = NULL;
+  PNG::getDefaultOptions(&options.png);
+
+  err = cmdLineParse(argc, argv, atlasname, &options);
+  if (err) {
+    return err;
+  }
+  if (!options.watchDir) {
+    err = expandInputs(atlasname, &options);
+    if (err) {
+      return err;
+    }
+  }
+  if (!options.quiet) {
+    printf("Generating images with seed %u\n", seed);
+  }
+
+  CacheManifest manifest;
+  char cacheFileName[sizeof(atlasname) + 8];
+  snprintf(cacheFileName, sizeof(cacheFileName), "%s.cache", atlasname);
+
+  if (options.watchDir) {
+    return watchDirectory(atlasname, cacheFileName, &options);
+  }
+
+  if (options.cache) {
+    stats.beginPhase(Stats::PhaseCache);
+    bool upToDate =
+        updateFromCache(atlasname, cacheFileName, &options, &stats);
+    stats.endPhase(Stats::PhaseCache);
+    if (upToDate) {
+      return writeStats(&options, &stats);
+    }
+  }
+
+  stats.numImages = options.files.size();
+  stats.beginPhase(Stats::PhaseLoad);
+
+  if (!err) {
+
+    /*
+     * Rebuild everything. The cache of the last run goes first, so it can
+     * not describe outputs that are half rewritten if this run fails.
+     * Inputs are looked at before they are loaded, a change made while
+     * running is then seen by the next run.
+     */
+
+    remove(cacheFileName);
+
+    manifest.signature = getSignature(&options);
+    manifest.inputs.resize(options.files.size());
+    for (size_t i = 0; i < options.files.size(); i++) {
+      manifest.inputs[i].path = options.files[i];
+    }
+    Parallel::forEach(manifest.inputs.size(), options.jobs, statInput,
+                      &manifest);
+
+    err = loadImages(&options, &surfaces);
+  }
+
+  stats.endPhase(Stats::PhaseLoad);
+
+  if (!err) {
+
+    /*
+     * Pack the images, in as many pages of the largest atlas size as it
+     * takes
+     */
+
+    std::vector<TextureAtlas::Input> inputs(surfaces.size());
+    for (size_t i = 0; i < surfaces.size(); i++) {
+      const char *fileName = options.fileNames[i];
+      setInput(&inputs[i],
+               options.names.intern(fileName, getSpriteNameLength(fileName)),
+               surfaces[i]);
+    }
+
+    err = buildAtlas(atlasname, cacheFileName, &options, inputs, &manifest,
+                     NULL, &stats);
+  }
+
+  if (writeStats(&options, &stats)) {
+    err = -1;
   }
 
   return err;
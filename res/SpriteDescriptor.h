@@ -1,8 +1,18 @@
 #ifndef _SPRITE_DESCRIPTOR_H_
 #define _SPRITE_DESCRIPTOR_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SPRITEMAP_BIN_MMAP
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -17,16 +27,50 @@ typedef struct SpriteDescriptor {
   /* Sprite Name (from file) */
   const char *name;
 
+  /* spritemap_hash_name(name, 0), compared before the names on lookup */
+  unsigned int nameHash;
+
+  /* Page (image file) of the sprite map the sprite is on */
+  int page;
+
   /* Sprite Coordinates (in integers) */
   int left, top, right, bottom;
 
   /* Sprite Size (integers) */
   int width, height;
 
+  /*
+    Non-zero if the sprite is stored turned 90 degrees clockwise in the map.
+    Coordinates and size are then those of the turned sprite, pixel (x, y)
+    of the original sprite is found at (right - 1 - y, top + x).
+  */
+  int rotated;
+
+  /*
+    Area of the original image the sprite was cut from when transparent
+    borders are trimmed off: the sprite starts at trimLeft, trimTop in an
+    image of sourceWidth x sourceHeight pixels. Without trimming the offset
+    is 0, 0 and the source size is the sprite size.
+  */
+  int trimLeft, trimTop;
+  int sourceWidth, sourceHeight;
+
 } SpriteDescriptor;
 
 
 
+typedef struct SpritePageDescriptor {
+
+  /* Page Image File Name */
+  const char *imageFileName;
+
+  /* Page size (pixels) */
+  const int width, height;
+
+} SpritePageDescriptor;
+
+
+
 typedef struct SpriteMapDescriptor {
   
   /* Sprite Map Name */
@@ -38,6 +82,26 @@ typedef struct SpriteMapDescriptor {
   /* Sprite Map size (pixels) */
   const int width, height;  
 
+  /*
+    Number of pages (image files) the sprites are spread over and their
+    descriptors. Sprite maps too large for one image get several pages,
+    imageFileName, width and height above are then those of page 0.
+  */
+  const unsigned int numPages;
+  const SpritePageDescriptor *pages;
+
+  /*
+    Minimal perfect hash of the sprite names, for
+    spritemap_find_sprite_hashed(). A name hashes to a bucket, the bucket's
+    displacement gives the slot of the name: -1 - displacement if negative,
+    else spritemap_hash_name(name, displacement) % numHashSlots. Slots hold
+    sprite indexes. hashDisplacements is NULL if there is no hash.
+  */
+  const unsigned int numHashBuckets;
+  const int *hashDisplacements;
+  const unsigned int numHashSlots;
+  const unsigned int *hashSlots;
+
   /* Number of sprites in sprite map */
   const unsigned int numSprites;
 
@@ -47,6 +111,25 @@ typedef struct SpriteMapDescriptor {
 } SpriteMapDescriptor;
 
 
+/*
+  Hash a sprite name (FNV-1a from a seeded basis, then mixed)
+*/
+static inline uint32_t spritemap_hash_name(const char *name, uint32_t seed)
+{
+  uint32_t hash = 2166136261u ^ seed;
+  while (*name) {
+    hash ^= (unsigned char)*name++;
+    hash *= 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+
 /*
   Find a sprite by name from sprite map
 */
@@ -61,6 +144,35 @@ static inline const SpriteDescriptor *spritemap_find_sprite(const SpriteMapDescr
 }
 
 
+/*
+  Find a sprite by name from sprite map in constant time, using the
+  generated name hash. Falls back to spritemap_find_sprite() if the map
+  has none.
+*/
+static inline const SpriteDescriptor *spritemap_find_sprite_hashed(const SpriteMapDescriptor *spriteMap, const char *name)
+{
+  const SpriteDescriptor *sprite;
+  uint32_t hash;
+  unsigned int slot;
+  int displacement;
+
+  if (!spriteMap->hashDisplacements)
+    return spritemap_find_sprite(spriteMap, name);
+
+  hash = spritemap_hash_name(name, 0);
+  displacement = spriteMap->hashDisplacements[hash % spriteMap->numHashBuckets];
+  if (displacement < 0)
+    slot = -1 - displacement;
+  else
+    slot = spritemap_hash_name(name, displacement) % spriteMap->numHashSlots;
+
+  sprite = &spriteMap->sprites[spriteMap->hashSlots[slot]];
+  if (sprite->nameHash == hash && strcmp(sprite->name, name) == 0)
+    return sprite;
+  return NULL;
+}
+
+
 /*
   Get a sprite by index from sprite map
 */
@@ -82,6 +194,15 @@ static inline const struct SpriteMapDescriptor *spritemap_get_map(const SpriteDe
 }
 
 
+/*
+  Get the page (image file) a sprite is on
+*/
+static inline const SpritePageDescriptor *spritemap_get_page(const SpriteMapDescriptor *spriteMap, const SpriteDescriptor *sprite)
+{
+  return &spriteMap->pages[sprite->page];
+}
+
+
 /*
   Convert from pixel position to a scaled value (0.0 - 1.0) where 0 is pixel 0 and 1.0 is map width
 */
@@ -99,6 +220,232 @@ static inline float spritemap_get_fypos(const SpriteMapDescriptor *spriteMap, in
   return (((float)y / (float)spriteMap->height));
 }
 
+
+
+/*
+  Binary sprite maps
+
+  The same data as a SpriteMapDescriptor, in a file that is used as it is
+  once mapped to memory. All values are 32 bit little endian, records
+  follow the header and strings are offsets into a table of zero
+  terminated strings at the end of the file.
+*/
+
+#define SPRITEMAP_BIN_MAGIC "TXAT"
+#define SPRITEMAP_BIN_VERSION 1
+
+typedef struct SpriteMapBinHeader {
+
+  /* SPRITEMAP_BIN_MAGIC and SPRITEMAP_BIN_VERSION */
+  char magic[4];
+  uint32_t version;
+
+  /* Size of the whole file */
+  uint32_t fileSize;
+
+  /* Sprite map name (string offset) */
+  uint32_t name;
+
+  /* Page and sprite records, offsets from the start of the file */
+  uint32_t numPages;
+  uint32_t pagesOffset;
+  uint32_t numSprites;
+  uint32_t spritesOffset;
+
+  /* String table */
+  uint32_t stringsOffset;
+  uint32_t stringsSize;
+
+} SpriteMapBinHeader;
+
+
+typedef struct SpritePageBinDescriptor {
+
+  /* Page image file name (string offset) */
+  uint32_t imageFileName;
+
+  int32_t width, height;
+
+} SpritePageBinDescriptor;
+
+
+/*
+  As SpriteDescriptor, the index in the map is the position of the record
+*/
+typedef struct SpriteBinDescriptor {
+
+  /* Sprite name (string offset) */
+  uint32_t name;
+
+  int32_t page;
+  int32_t left, top, right, bottom;
+  int32_t width, height;
+  int32_t rotated;
+  int32_t trimLeft, trimTop;
+  int32_t sourceWidth, sourceHeight;
+
+} SpriteBinDescriptor;
+
+
+typedef struct SpriteMapBin {
+
+  /* The file contents */
+  const unsigned char *data;
+  size_t size;
+
+  /* Non-zero if data is a mapping owned by the sprite map */
+  int mapped;
+
+  const SpriteMapBinHeader *header;
+  const SpritePageBinDescriptor *pages;
+  const SpriteBinDescriptor *sprites;
+  const char *strings;
+
+} SpriteMapBin;
+
+
+/*
+  Use a binary sprite map already in memory. The data must stay valid, and
+  be 4 byte aligned, while the sprite map is used.
+  Returns 0 on success, -1 if the data is not a valid sprite map.
+*/
+static inline int spritemap_bin_from_memory(SpriteMapBin *spriteMap, const void *data, size_t size)
+{
+  const SpriteMapBinHeader *header = (const SpriteMapBinHeader *)data;
+  const uint32_t one = 1;
+
+  memset(spriteMap, 0, sizeof(*spriteMap));
+
+  /* Records are used as they are, so only on little endian machines */
+  if (*(const unsigned char *)&one != 1)
+    return -1;
+
+  if (size < sizeof(SpriteMapBinHeader) ||
+      memcmp(header->magic, SPRITEMAP_BIN_MAGIC, 4) != 0 ||
+      header->version != SPRITEMAP_BIN_VERSION ||
+      header->fileSize != size)
+    return -1;
+
+  if (header->pagesOffset % 4 != 0 || header->spritesOffset % 4 != 0 ||
+      header->pagesOffset > size ||
+      header->numPages > (size - header->pagesOffset) / sizeof(SpritePageBinDescriptor) ||
+      header->spritesOffset > size ||
+      header->numSprites > (size - header->spritesOffset) / sizeof(SpriteBinDescriptor) ||
+      header->stringsOffset > size ||
+      header->stringsSize == 0 ||
+      header->stringsSize > size - header->stringsOffset)
+    return -1;
+
+  spriteMap->data = (const unsigned char *)data;
+  spriteMap->size = size;
+  spriteMap->header = header;
+  spriteMap->pages = (const SpritePageBinDescriptor *)(spriteMap->data + header->pagesOffset);
+  spriteMap->sprites = (const SpriteBinDescriptor *)(spriteMap->data + header->spritesOffset);
+  spriteMap->strings = (const char *)(spriteMap->data + header->stringsOffset);
+
+  /* The last string must end in the table */
+  if (spriteMap->strings[header->stringsSize - 1] != '\0')
+    return -1;
+
+  return 0;
+}
+
+
+#ifdef SPRITEMAP_BIN_MMAP
+/*
+  Map a binary sprite map file to memory. Replacing an atlas at runtime is
+  closing the old one and opening the new one.
+  Returns 0 on success, -1 on error.
+*/
+static inline int spritemap_bin_open(SpriteMapBin *spriteMap, const char *fileName)
+{
+  struct stat st;
+  void *data;
+  int fd = open(fileName, O_RDONLY);
+
+  memset(spriteMap, 0, sizeof(*spriteMap));
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return -1;
+  }
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return -1;
+
+  if (spritemap_bin_from_memory(spriteMap, data, st.st_size) != 0) {
+    munmap(data, st.st_size);
+    return -1;
+  }
+  spriteMap->mapped = 1;
+  return 0;
+}
+#endif
+
+
+/*
+  Release a binary sprite map
+*/
+static inline void spritemap_bin_close(SpriteMapBin *spriteMap)
+{
+#ifdef SPRITEMAP_BIN_MMAP
+  if (spriteMap->mapped)
+    munmap((void *)spriteMap->data, spriteMap->size);
+#endif
+  memset(spriteMap, 0, sizeof(*spriteMap));
+}
+
+
+/*
+  Get a string of a binary sprite map by its offset
+*/
+static inline const char *spritemap_bin_get_string(const SpriteMapBin *spriteMap, uint32_t offset)
+{
+  if (offset >= spriteMap->header->stringsSize)
+    return "";
+  return spriteMap->strings + offset;
+}
+
+
+/*
+  Get a sprite by index from binary sprite map
+*/
+static inline const SpriteBinDescriptor *spritemap_bin_get_sprite(const SpriteMapBin *spriteMap, unsigned int offset)
+{
+  if (offset >= spriteMap->header->numSprites)
+    return NULL;
+  return &spriteMap->sprites[offset];
+}
+
+
+/*
+  Find a sprite by name from binary sprite map
+*/
+static inline const SpriteBinDescriptor *spritemap_bin_find_sprite(const SpriteMapBin *spriteMap, const char *name)
+{
+  unsigned int i;
+  for (i = 0; i < spriteMap->header->numSprites; i ++) {
+    if (strcmp(spritemap_bin_get_string(spriteMap, spriteMap->sprites[i].name), name) == 0)
+      return &spriteMap->sprites[i];
+  }
+  return NULL;
+}
+
+
+/*
+  Get the page (image file) a sprite of a binary sprite map is on
+*/
+static inline const SpritePageBinDescriptor *spritemap_bin_get_page(const SpriteMapBin *spriteMap, const SpriteBinDescriptor *sprite)
+{
+  if ((uint32_t)sprite->page >= spriteMap->header->numPages)
+    return NULL;
+  return &spriteMap->pages[sprite->page];
+}
+
 #ifdef __cplusplus
 }
 #endif
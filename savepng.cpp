@@ -1,11 +1,21 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#include <algorithm>
 #include <png.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
+#include <zlib.h>
 
+#include "Parallel.h"
 #include "savepng.h"
 
+/* Largest back reference of deflate, the dictionary given to each band */
+#define DEFLATE_WINDOW_SIZE 32768
+
+/* Bands per worker, for load balancing */
+#define BANDS_PER_WORKER 4
+
 static int png_colortype_from_surface(SDL_Surface *surface)
 {
   int colortype = PNG_COLOR_MASK_COLOR; /* grayscale not supported */
@@ -30,13 +40,346 @@ void png_user_error(png_structp ctx, png_const_charp str)
   fprintf(stderr, "libpng: error: %s\n", str);
 }
 
+void PNG::getDefaultOptions(Options *options)
+{
+  options->level = -1;
+  options->filter = FilterAdaptive;
+  options->fast = false;
+  options->jobs = 1;
+}
+
+int PNG::getFilterByName(const char *name)
+{
+  static const char *names[] = {"adaptive", "none", "sub",
+                                "up",       "average", "paeth"};
+  for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int paethPredictor(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+/*
+ * Filter one row with the given PNG filter type (1-4, 0 is none). The
+ * previous row is NULL for the first row of the image.
+ */
+static void filterRow(int type, const Uint8 *row, const Uint8 *prev,
+                      int rowBytes, int bpp, Uint8 *out)
+{
+  for (int i = 0; i < rowBytes; i++) {
+    int left = i >= bpp ? row[i - bpp] : 0;
+    int up = prev ? prev[i] : 0;
+    int upLeft = (prev && i >= bpp) ? prev[i - bpp] : 0;
+    int predicted;
+
+    switch (type) {
+    case 1:
+      predicted = left;
+      break;
+    case 2:
+      predicted = up;
+      break;
+    case 3:
+      predicted = (left + up) >> 1;
+      break;
+    case 4:
+      predicted = paethPredictor(left, up, upLeft);
+      break;
+    default:
+      predicted = 0;
+      break;
+    }
+    out[i] = row[i] - predicted;
+  }
+}
+
+/* Sum of the filtered bytes taken as signed, smaller compresses better */
+static unsigned long getRowCost(const Uint8 *out, int rowBytes)
+{
+  unsigned long cost = 0;
+  for (int i = 0; i < rowBytes; i++) {
+    cost += out[i] < 128 ? out[i] : 256 - out[i];
+  }
+  return cost;
+}
+
+struct EncodeParams {
+  const Uint8 *pixels;
+  int pitch;
+  int height;
+  int rowBytes;
+  int bpp;
+  int filterType; /* PNG filter type, -1 for adaptive */
+  int level;
+  int strategy;
+
+  int rowsPerBand;
+  int numBands;
+
+  /* Filtered rows, each led by its filter type byte */
+  std::vector<Uint8> filtered;
+
+  /* Per band */
+  std::vector<std::vector<Uint8> > deflated;
+  std::vector<uLong> adler;
+  std::vector<int> err;
+};
+
+static void filterBand(int band, int worker, void *param)
+{
+  struct EncodeParams *params = (struct EncodeParams *)param;
+  int rowBytes = params->rowBytes;
+  int first = band * params->rowsPerBand;
+  int last = std::min(first + params->rowsPerBand, params->height);
+  std::vector<Uint8> trial(rowBytes);
+
+  for (int y = first; y < last; y++) {
+    const Uint8 *row = params->pixels + y * params->pitch;
+    const Uint8 *prev = y > 0 ? row - params->pitch : NULL;
+    Uint8 *out = &params->filtered[y * (1 + rowBytes)];
+    int type = params->filterType;
+
+    if (type < 0) {
+      /* Keep the filter with the lowest cost, as libpng does */
+      unsigned long bestCost = 0;
+      for (int t = 0; t < 5; t++) {
+        filterRow(t, row, prev, rowBytes, params->bpp, &trial[0]);
+        unsigned long cost = getRowCost(&trial[0], rowBytes);
+        if (t == 0 || cost < bestCost) {
+          bestCost = cost;
+          type = t;
+          memcpy(out + 1, &trial[0], rowBytes);
+        }
+      }
+    } else {
+      filterRow(type, row, prev, rowBytes, params->bpp, out + 1);
+    }
+    out[0] = type;
+  }
+}
+
+/*
+ * Compress a band of filtered rows to raw deflate data. The band is primed
+ * with the data before it, so it compresses about as well as one stream,
+ * and all but the last band end on a byte boundary so they can be joined.
+ */
+static void deflateBand(int band, int worker, void *param)
+{
+  struct EncodeParams *params = (struct EncodeParams *)param;
+  size_t bandBytes = (size_t)params->rowsPerBand * (1 + params->rowBytes);
+  size_t offset = band * bandBytes;
+  size_t size = std::min(bandBytes, params->filtered.size() - offset);
+  const Uint8 *data = &params->filtered[offset];
+  bool lastBand = band == params->numBands - 1;
+  std::vector<Uint8> &out = params->deflated[band];
+  z_stream strm;
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, params->level, Z_DEFLATED, -15, 8,
+                   params->strategy) != Z_OK) {
+    params->err[band] = -1;
+    return;
+  }
+
+  if (offset > 0) {
+    size_t dictSize = std::min(offset, (size_t)DEFLATE_WINDOW_SIZE);
+    deflateSetDictionary(&strm, data - dictSize, dictSize);
+  }
+
+  /* Room for the sync flush marker on top of the bound */
+  out.resize(deflateBound(&strm, size) + 16);
+  strm.next_in = (Bytef *)data;
+  strm.avail_in = size;
+
+  /*
+   * A flush is not complete while deflate() leaves the output full, it
+   * then has to be called again with more room. Z_BUF_ERROR only means
+   * the call had nothing left to write.
+   */
+  int flush = lastBand ? Z_FINISH : Z_SYNC_FLUSH;
+  size_t used = 0;
+  int ret;
+  do {
+    if (used == out.size()) {
+      out.resize(out.size() * 2);
+    }
+    strm.next_out = &out[used];
+    strm.avail_out = out.size() - used;
+    ret = deflate(&strm, flush);
+    used = out.size() - strm.avail_out;
+  } while ((ret == Z_OK || ret == Z_BUF_ERROR) && strm.avail_out == 0);
+
+  bool flushed = lastBand ? ret == Z_STREAM_END
+                          : ret == Z_OK || ret == Z_BUF_ERROR;
+  if (!flushed || strm.avail_in != 0) {
+    params->err[band] = -1;
+  }
+  out.resize(used);
+  deflateEnd(&strm);
+
+  params->adler[band] = adler32(adler32(0, NULL, 0), data, size);
+}
+
+static void putUint32(Uint8 *buf, uLong value)
+{
+  buf[0] = value >> 24;
+  buf[1] = value >> 16;
+  buf[2] = value >> 8;
+  buf[3] = value;
+}
+
+/*
+ * Write a png chunk made of a number of data pieces
+ */
+static int writeChunk(FILE *fp, const char *type, const Uint8 **data,
+                      const size_t *size, int numPieces)
+{
+  Uint8 buf[4];
+  size_t length = 0;
+  for (int i = 0; i < numPieces; i++) {
+    length += size[i];
+  }
+
+  uLong crc = crc32(0, (const Bytef *)type, 4);
+  putUint32(buf, length);
+  fwrite(buf, 1, 4, fp);
+  fwrite(type, 1, 4, fp);
+  for (int i = 0; i < numPieces; i++) {
+    if (size[i] > 0) {
+      fwrite(data[i], 1, size[i], fp);
+      crc = crc32(crc, data[i], size[i]);
+    }
+  }
+  putUint32(buf, crc);
+  fwrite(buf, 1, 4, fp);
+
+  return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * Save a surface with 8 bit color channels, compressing row bands on
+ * separate threads. Each band goes to its own IDAT chunk, the zlib header
+ * leads the first one and the combined checksum ends the last one.
+ */
+static int saveParallel(SDL_Surface *surf, const char *filename, int colortype,
+                        int filterType, int level, int strategy,
+                        int numWorkers)
+{
+  struct EncodeParams params;
+  params.pixels = (const Uint8 *)surf->pixels;
+  params.pitch = surf->pitch;
+  params.height = surf->h;
+  params.bpp = surf->format->BytesPerPixel;
+  params.rowBytes = surf->w * params.bpp;
+  params.filterType = filterType;
+  params.level = level;
+  params.strategy = strategy;
+  params.numBands = std::min(surf->h, numWorkers * BANDS_PER_WORKER);
+  params.rowsPerBand = (surf->h + params.numBands - 1) / params.numBands;
+  params.numBands = (surf->h + params.rowsPerBand - 1) / params.rowsPerBand;
+  params.filtered.resize((size_t)surf->h * (1 + params.rowBytes));
+  params.deflated.resize(params.numBands);
+  params.adler.resize(params.numBands);
+  params.err.assign(params.numBands, 0);
+
+  /* Bands are primed with the filtered rows before them, filter all first */
+  Parallel::forEach(params.numBands, numWorkers, filterBand, &params);
+  Parallel::forEach(params.numBands, numWorkers, deflateBand, &params);
+
+  uLong adler = adler32(0, NULL, 0);
+  for (int i = 0; i < params.numBands; i++) {
+    if (params.err[i]) {
+      printf("Failed to compress %s\n", filename);
+      return -1;
+    }
+    size_t bandBytes = (size_t)params.rowsPerBand * (1 + params.rowBytes);
+    size_t size =
+        std::min(bandBytes, params.filtered.size() - i * bandBytes);
+    adler = adler32_combine(adler, params.adler[i], size);
+  }
+
+  FILE *fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    perror("fopen error");
+    return -1;
+  }
+
+  static const Uint8 signature[8] = {0x89, 'P',  'N',  'G',
+                                     '\r', '\n', 0x1a, '\n'};
+  fwrite(signature, 1, sizeof(signature), fp);
+
+  Uint8 ihdr[13];
+  putUint32(ihdr, surf->w);
+  putUint32(ihdr + 4, surf->h);
+  ihdr[8] = 8; /* Bit depth */
+  ihdr[9] = colortype;
+  ihdr[10] = PNG_COMPRESSION_TYPE_DEFAULT;
+  ihdr[11] = PNG_FILTER_TYPE_DEFAULT;
+  ihdr[12] = PNG_INTERLACE_NONE;
+  const Uint8 *data[3] = {ihdr};
+  size_t size[3] = {sizeof(ihdr)};
+  int err = writeChunk(fp, "IHDR", data, size, 1);
+
+  /* zlib header for a 32K window, with the level hint zlib would give */
+  int levelFlags = level == Z_DEFAULT_COMPRESSION ? 2
+                   : level < 2                   ? 0
+                   : level < 6                   ? 1
+                   : level == 6                  ? 2
+                                                 : 3;
+  unsigned int header = (0x78 << 8) | (levelFlags << 6);
+  header += 31 - (header % 31);
+  Uint8 zlibHeader[2] = {(Uint8)(header >> 8), (Uint8)header};
+  Uint8 zlibTrailer[4];
+  putUint32(zlibTrailer, adler);
+
+  for (int i = 0; i < params.numBands && !err; i++) {
+    int n = 0;
+    if (i == 0) {
+      data[n] = zlibHeader;
+      size[n++] = sizeof(zlibHeader);
+    }
+    data[n] = params.deflated[i].empty() ? NULL : &params.deflated[i][0];
+    size[n++] = params.deflated[i].size();
+    if (i == params.numBands - 1) {
+      data[n] = zlibTrailer;
+      size[n++] = sizeof(zlibTrailer);
+    }
+    err = writeChunk(fp, "IDAT", data, size, n);
+  }
+
+  if (!err) {
+    err = writeChunk(fp, "IEND", data, size, 0);
+  }
+
+  if (fclose(fp) != 0 || err) {
+    printf("Failed to write %s\n", filename);
+    return -1;
+  }
+
+  return 0;
+}
+
 /*
  * png_save()
  *
  * Save a SDL Surface as a png image file.
  * Returns 0 if successfully saved, else error.
  */
-int PNG::save(SDL_Surface *surf, const char *filename)
+int PNG::save(SDL_Surface *surf, const char *filename,
+              const Options *options)
 {
   FILE *fp;
   png_structp png_ptr;
@@ -44,6 +387,27 @@ int PNG::save(SDL_Surface *surf, const char *filename)
   int i, colortype;
   png_bytep *row_pointers;
 
+  Options defaults;
+  if (!options) {
+    getDefaultOptions(&defaults);
+    options = &defaults;
+  }
+
+  int level = options->fast ? 1 : options->level;
+  Filter filter = options->fast ? FilterUp : options->filter;
+  /* As libpng picks it */
+  int strategy = filter == FilterNone ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+
+  colortype = png_colortype_from_surface(surf);
+
+  int numWorkers = Parallel::getNumWorkers(surf->h, options->jobs);
+  if (numWorkers > 1 && !surf->format->palette &&
+      surf->format->BytesPerPixel >= 3) {
+    return saveParallel(surf, filename, colortype,
+                        filter == FilterAdaptive ? -1 : filter - FilterNone,
+                        level, strategy, numWorkers);
+  }
+
   /* Opening output file */
   fp = fopen(filename, "wb");
   if (fp == NULL) {
@@ -74,7 +438,16 @@ int PNG::save(SDL_Surface *surf, const char *filename)
 
   png_init_io(png_ptr, fp);
 
-  colortype = png_colortype_from_surface(surf);
+  if (level != -1) {
+    png_set_compression_level(png_ptr, level);
+  }
+  if (filter != FilterAdaptive) {
+    static const int filters[] = {PNG_ALL_FILTERS, PNG_FILTER_NONE,
+                                  PNG_FILTER_SUB,  PNG_FILTER_UP,
+                                  PNG_FILTER_AVG,  PNG_FILTER_PAETH};
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters[filter]);
+  }
+
   png_set_IHDR(png_ptr, info_ptr, surf->w, surf->h, 8, colortype,
                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                PNG_FILTER_TYPE_DEFAULT);
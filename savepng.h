@@ -6,13 +6,49 @@
 class PNG {
 
 public:
+  /* Row filter applied before compression */
+  enum Filter {
+    FilterAdaptive, /* Best of all filters, picked per row */
+    FilterNone,
+    FilterSub,
+    FilterUp,
+    FilterAverage,
+    FilterPaeth,
+  };
+
+  struct Options {
+    int level;     /* zlib compression level 0-9, -1 for the zlib default */
+    Filter filter;
+    bool fast;     /* Level 1 compression and the up filter, overrides
+                      level and filter */
+    int jobs;      /* Threads compressing row bands, see Parallel */
+  };
+
+  /*
+   * getDefaultOptions()
+   *
+   * Options giving the libpng defaults on one thread.
+   */
+  static void getDefaultOptions(Options *options);
+
+  /*
+   * getFilterByName()
+   *
+   * Filter by its command line name (adaptive, none, sub, up, average,
+   * paeth). Returns -1 if unknown.
+   */
+  static int getFilterByName(const char *name);
+
   /*
    * save()
    *
-   * Save a SDL Surface as a png image file.
+   * Save a SDL Surface as a png image file. With more than one job the
+   * rows are filtered and compressed in bands on separate threads and
+   * joined into one zlib stream.
    * Returns 0 if successfully saved, else error.
    */
-  static int save(SDL_Surface *surf, const char *filename);
+  static int save(SDL_Surface *surf, const char *filename,
+                  const Options *options = NULL);
 };
 
 #endif